@@ -0,0 +1,167 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+// Run control for a single temperature point: equilibration is detected
+// instead of assumed, and sampling continues until the requested errors are
+// met instead of for a fixed number of sweeps.
+//
+// Two chains are run side by side, one from an ordered and one from a
+// disordered start. Burn-in ends once their mean energies over the last
+// window agree within their errors; the window doubles after every failed
+// comparison, so burn-in costs at most about twice what it needs. Both
+// chains are then sampled, their measurements pooled, and the errors of E,
+// M, C and chi estimated by jackknife over blocks (which accounts for
+// autocorrelation as long as blocks are longer than it). Sampling stops
+// when every error is below its target or maxSweeps is reached.
+struct AdaptiveSettings {
+  int window = 32;           // first burn-in comparison window, in sweeps
+  int maxBurn = 1 << 14;     // per chain
+  int minSteps = 256;        // per chain, before the first error check
+  int maxSweeps = 1 << 15;   // burn-in plus sampling, per chain
+  double absoluteError = 2e-3;  // target for E and M (per site)
+  double relativeError = 0.05;  // target for C and chi
+  int blocks = 16;           // jackknife blocks per chain
+};
+
+struct AdaptiveResult {
+  double e = 0, m = 0, c = 0, x = 0;
+  double de = 0, dm = 0, dc = 0, dx = 0;
+  int burn = 0;    // sweeps per chain discarded as burn-in
+  int steps = 0;   // measured sweeps per chain
+  bool equilibrated = false;
+  bool converged = false;  // all error targets met
+};
+
+namespace detail {
+
+struct Moments {
+  double e = 0, m = 0, e2 = 0, m2 = 0, n = 0;
+
+  void add(double _e, double _m) {
+    e += _e;
+    m += _m;
+    e2 += _e * _e;
+    m2 += _m * _m;
+    n++;
+  }
+
+  Moments& operator+=(const Moments& o) {
+    e += o.e; m += o.m; e2 += o.e2; m2 += o.m2; n += o.n;
+    return *this;
+  }
+
+  Moments& operator-=(const Moments& o) {
+    e -= o.e; m -= o.m; e2 -= o.e2; m2 -= o.m2; n -= o.n;
+    return *this;
+  }
+
+  // {E, M, C, chi} for a lattice of volume sites at temperature T.
+  std::array<double, 4> estimates(int volume, double T) const {
+    double _e = e / n, _m = m / n;
+    return {_e, _m, (e2 / n - _e * _e) * volume / (T * T), (m2 / n - _m * _m) * volume / T};
+  }
+};
+
+// Mean and standard error of the mean of x[begin, end) from `blocks` block
+// means.
+inline void blockMean(const std::vector<double>& x, int begin, int end, int blocks, double& mean, double& error) {
+  int length = (end - begin) / blocks;
+  std::vector<double> means(blocks, 0.0);
+  for (int b = 0; b < blocks; b++) {
+    for (int i = 0; i < length; i++) means[b] += x[begin + b * length + i] / length;
+  }
+  mean = 0;
+  for (double v : means) mean += v / blocks;
+  double var = 0;
+  for (double v : means) var += (v - mean) * (v - mean) / (blocks - 1);
+  error = std::sqrt(var / blocks);
+}
+
+}  // namespace detail
+
+template <typename Model>
+AdaptiveResult sampleAdaptive(Model& ordered, Model& disordered, const std::function<void(Model&)>& sweep,
+                              const AdaptiveSettings& s = {}) {
+  AdaptiveResult result;
+  Model* chains[2] = {&ordered, &disordered};
+  const int volume = ordered.size();
+  const double T = ordered.T;
+
+  // Burn-in: compare windowed mean energies of the two chains.
+  std::vector<double> energy[2];
+  int window = s.window;
+  while (result.burn + window <= s.maxBurn) {
+    double mean[2], error[2];
+    for (int c = 0; c < 2; c++) {
+      energy[c].resize(window);
+      for (int i = 0; i < window; i++) {
+        sweep(*chains[c]);
+        energy[c][i] = chains[c]->currentEnergy();
+      }
+      detail::blockMean(energy[c], 0, window, 8, mean[c], error[c]);
+    }
+    result.burn += window;
+    if (std::abs(mean[0] - mean[1]) < 2 * std::hypot(error[0], error[1])) {
+      result.equilibrated = true;
+      break;
+    }
+    window *= 2;
+  }
+
+  // Sampling: per-chain series, checked after minSteps and then every time
+  // they have grown by half.
+  std::vector<double> e[2], m[2];
+  int next = s.minSteps;
+  while (true) {
+    int target = std::min(next, s.maxSweeps - result.burn);
+    for (int c = 0; c < 2; c++) {
+      for (int i = result.steps; i < target; i++) {
+        sweep(*chains[c]);
+        e[c].push_back(chains[c]->currentEnergy());
+        m[c].push_back(chains[c]->currentMagnetization());
+      }
+    }
+    result.steps = std::max(target, 0);
+    if (result.steps < s.blocks) break;
+
+    // Jackknife over blocks of both chains.
+    const int length = result.steps / s.blocks;
+    std::vector<detail::Moments> block(2 * s.blocks);
+    detail::Moments all;
+    for (int c = 0; c < 2; c++) {
+      for (int b = 0; b < s.blocks; b++) {
+        auto& mom = block[c * s.blocks + b];
+        for (int i = b * length; i < (b + 1) * length; i++) mom.add(e[c][i], m[c][i]);
+        all += mom;
+      }
+    }
+    auto full = all.estimates(volume, T);
+    const int n = block.size();
+    std::array<double, 4> mean{}, var{};
+    std::vector<std::array<double, 4>> leaveOut(n);
+    for (int b = 0; b < n; b++) {
+      detail::Moments rest = all;
+      rest -= block[b];
+      leaveOut[b] = rest.estimates(volume, T);
+      for (int k = 0; k < 4; k++) mean[k] += leaveOut[b][k] / n;
+    }
+    for (int b = 0; b < n; b++) {
+      for (int k = 0; k < 4; k++) var[k] += (leaveOut[b][k] - mean[k]) * (leaveOut[b][k] - mean[k]);
+    }
+    std::array<double, 4> err;
+    for (int k = 0; k < 4; k++) err[k] = std::sqrt(var[k] * (n - 1) / n);
+
+    result.e = full[0]; result.m = full[1]; result.c = full[2]; result.x = full[3];
+    result.de = err[0]; result.dm = err[1]; result.dc = err[2]; result.dx = err[3];
+    result.converged = err[0] <= s.absoluteError && err[1] <= s.absoluteError &&
+                       err[2] <= s.relativeError * std::abs(full[2]) &&
+                       err[3] <= s.relativeError * std::abs(full[3]);
+    if (result.converged || result.burn + result.steps >= s.maxSweeps) break;
+    next = result.steps + result.steps / 2;
+  }
+  return result;
+}
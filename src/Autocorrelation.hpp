@@ -0,0 +1,206 @@
+#pragma once
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <numbers>
+#include <numeric>
+#include <algorithm>
+
+// Autocorrelation functions and integrated autocorrelation times of
+// observable series. autocorrelation() works on a series in memory via FFT
+// in O(n log n); MultiTau accumulates an unbounded stream with fixed memory per
+// doubling of the lag. integratedTime() applies Sokal's automatic window to either.
+namespace autocorr {
+
+// In-place iterative radix-2 FFT; a.size() must be a power of two.
+inline void fft(std::vector<std::complex<double>>& a, bool inverse = false) {
+  const size_t n = a.size();
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) std::swap(a[i], a[j]);
+  }
+  for (size_t len = 2; len <= n; len <<= 1) {
+    double angle = (inverse ? 2 : -2) * std::numbers::pi / len;
+    std::complex<double> step(std::cos(angle), std::sin(angle));
+    for (size_t start = 0; start < n; start += len) {
+      std::complex<double> w = 1;
+      for (size_t k = 0; k < len / 2; k++) {
+        auto u = a[start + k];
+        auto v = a[start + k + len / 2] * w;
+        a[start + k] = u + v;
+        a[start + k + len / 2] = u - v;
+        w *= step;
+      }
+    }
+  }
+  if (inverse) {
+    for (auto& x : a) x /= static_cast<double>(n);
+  }
+}
+
+// Normalized autocorrelation rho(t) = Gamma(t) / Gamma(0) for t < n, with
+// Gamma(t) = 1/(n - t) sum_k (x_k - mean)(x_{k+t} - mean). Zero padding to
+// at least 2n keeps the circular correlation from wrapping around.
+inline std::vector<double> autocorrelation(const std::vector<double>& x) {
+  const size_t n = x.size();
+  if (n == 0) return {};
+  double mean = std::accumulate(x.begin(), x.end(), 0.0) / n;
+
+  size_t size = 1;
+  while (size < 2 * n) size <<= 1;
+  std::vector<std::complex<double>> a(size, 0.0);
+  for (size_t k = 0; k < n; k++) a[k] = x[k] - mean;
+
+  fft(a);
+  for (auto& c : a) c = std::norm(c);
+  fft(a, true);
+
+  std::vector<double> rho(n);
+  double gamma0 = a[0].real() / n;
+  for (size_t t = 0; t < n; t++) {
+    rho[t] = gamma0 > 0 ? a[t].real() / (n - t) / gamma0 : 0.0;
+  }
+  return rho;
+}
+
+struct IntegratedTime {
+  double tau = 0.5;    // tau_int = 1/2 + sum_{t=1}^{W} rho(t)
+  double error = 0.0;  // statistical error of tau (Madras-Sokal)
+  int window = 0;      // W
+  bool converged = false;  // false if the series was too short for W
+};
+
+// Sokal's self-consistent window: the smallest W with W >= c * tau_int(W).
+// c around 5-10 balances the bias of cutting the sum off against the noise
+// of summing it further. n is the length of the underlying series.
+inline IntegratedTime integratedTime(const std::vector<double>& rho, size_t n, double c = 6.0) {
+  IntegratedTime result;
+  double tau = 0.5;
+  for (size_t t = 1; t < rho.size(); t++) {
+    tau += rho[t];
+    if (t >= c * tau) {
+      result.tau = tau;
+      result.window = static_cast<int>(t);
+      result.converged = true;
+      break;
+    }
+    result.tau = tau;
+    result.window = static_cast<int>(t);
+  }
+  result.error = result.tau * std::sqrt(2.0 * (2 * result.window + 1) / n);
+  return result;
+}
+
+// Same for correlations known at increasing, non-uniform lags (as from
+// MultiTau): the sum becomes the trapezoidal integral of rho over the lag.
+inline IntegratedTime integratedTime(const std::vector<double>& lags, const std::vector<double>& rho,
+                                     size_t n, double c = 6.0) {
+  IntegratedTime result;
+  double integral = 0;
+  for (size_t i = 1; i < rho.size(); i++) {
+    integral += 0.5 * (rho[i] + rho[i - 1]) * (lags[i] - lags[i - 1]);
+    // At unit spacing from lag 0 this is exactly 1/2 + sum_{t=1}^{W} rho(t).
+    double tau = integral + 0.5 * rho[i];
+    result.tau = tau;
+    result.window = static_cast<int>(lags[i]);
+    if (lags[i] >= c * tau) {
+      result.converged = true;
+      break;
+    }
+  }
+  result.error = result.tau * std::sqrt(2.0 * (2 * result.window + 1) / n);
+  return result;
+}
+
+// Online multiple-tau correlator (Ramirez et al., J. Chem. Phys. 133, 154103).
+// Level 0 correlates the raw series at lags 0..P-1; every further level
+// works on block averages over M values of the level below and covers lags
+// P/M..P-1 in its own units, so lag resolution falls with the lag while the
+// cost per sample stays O(P) amortized. Correlations are accumulated on the
+// raw values and the mean is subtracted at the end.
+class MultiTau {
+private:
+  static constexpr int P = 16;  // lags per level
+  static constexpr int M = 2;   // block size between levels
+
+  struct Level {
+    std::vector<double> history;  // most recent values, newest first
+    std::vector<double> products, counts;
+    double block = 0;  // running sum for the level above
+    int inBlock = 0;
+    long seen = 0;
+  };
+
+  std::vector<Level> levels;
+  int maxLevels;
+  long n = 0;
+  double total = 0;
+
+  void add(int l, double x) {
+    if (l >= maxLevels) return;
+    if (l == static_cast<int>(levels.size())) {
+      levels.push_back({std::vector(P, 0.0), std::vector(P, 0.0), std::vector(P, 0.0)});
+    }
+    Level& level = levels[l];
+    std::copy_backward(level.history.begin(), level.history.end() - 1, level.history.end());
+    level.history[0] = x;
+    level.seen++;
+
+    int first = l == 0 ? 0 : P / M;
+    for (int j = first; j < P && j < level.seen; j++) {
+      level.products[j] += x * level.history[j];
+      level.counts[j]++;
+    }
+
+    level.block += x;
+    if (++level.inBlock == M) {
+      double average = level.block / M;
+      level.block = 0;
+      level.inBlock = 0;
+      add(l + 1, average);
+    }
+  }
+
+public:
+  explicit MultiTau(int maxLevels_ = 32) : maxLevels(maxLevels_) {}
+
+  void push(double x) {
+    n++;
+    total += x;
+    add(0, x);
+  }
+
+  long size() const { return n; }
+
+  // Lags (in samples) and normalized correlations rho at those lags,
+  // increasing in lag and starting at lag 0.
+  void correlation(std::vector<double>& lags, std::vector<double>& rho) const {
+    lags.clear();
+    rho.clear();
+    if (n == 0) return;
+    double mean = total / n;
+    double gamma0 = 0;
+    double scale = 1;
+    for (int l = 0; l < static_cast<int>(levels.size()); l++, scale *= M) {
+      const Level& level = levels[l];
+      for (int j = l == 0 ? 0 : P / M; j < P; j++) {
+        if (level.counts[j] == 0) continue;
+        double gamma = level.products[j] / level.counts[j] - mean * mean;
+        if (l == 0 && j == 0) gamma0 = gamma;
+        lags.push_back(j * scale);
+        rho.push_back(gamma);
+      }
+    }
+    for (auto& r : rho) r = gamma0 > 0 ? r / gamma0 : 0.0;
+  }
+
+  IntegratedTime integratedTime(double c = 6.0) const {
+    std::vector<double> lags, rho;
+    correlation(lags, rho);
+    return autocorr::integratedTime(lags, rho, n, c);
+  }
+};
+
+}  // namespace autocorr
@@ -0,0 +1,405 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <concepts>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include "ThreadPool.hpp"
+#include "Random.hpp"
+#include "Telemetry.hpp"
+
+// XY model with the spin angles restricted to q = 2^k equally spaced values
+// 2 pi n / q (the Z_q clock model), for q up to 2^16. Spins are stored as
+// 16-bit level numbers n, a quarter of XYLattice's memory, and angle
+// differences wrap by masking instead of fmod. Bond energies, projections
+// and Boltzmann factors all come from tables indexed by a level difference,
+// so the update loops make no trig calls; the Boltzmann table is rebuilt
+// whenever T has changed since the last sweep.
+//
+// For large q the clock model goes over into the XY model (in 2D its
+// ordered low-temperature phase shrinks like 1/q^2), so runs at several q
+// show how far a quantity is from its continuum value. Metropolis and Wolff
+// as in XYLattice, on even extents.
+template <int D, typename Rng = prng::Xoshiro256pp>
+class ClockLattice {
+  static_assert(D >= 2 && D <= 4, "ClockLattice supports 2, 3 and 4 dimensions");
+
+public:
+  using Level = uint16_t;
+
+private:
+  Rng rng;
+  prng::SiteStream siteStream;
+  uint64_t streamSweeps = 0;
+  std::uniform_real_distribution<double> rand{0.0, 1.0};
+  std::array<int, D> L;
+  std::array<int, D> stride;
+  int volume = 1;
+  int q;
+  int mask;
+
+  // cosine[n] and sine[n] of the angle 2 pi n / q; half[j] = cos(pi j / q)
+  // for projections on the reflection axes of Wolff, which lie on and
+  // halfway between the levels; weight[n] = exp(cosine[n] / T), the
+  // Boltzmann factor of a bond, for weightT.
+  std::vector<double> cosine, sine, half, weight;
+  float weightT = 0;
+
+  std::unique_ptr<ThreadPool> pool;
+  telemetry::UpdateStats stats;
+
+  struct Site {
+    int index;
+    std::array<int, D> x;
+  };
+  std::vector<unsigned> visited;
+  unsigned generation = 0;
+  std::vector<Site> stack;
+  int wolffClusters = 0;
+  // XYLattice::wolffBudget.
+  double wolffSites = 0;
+  long wolffCount = 0;
+  float wolffT = -1;
+
+  double energySum = 0, mxSum = 0, mySum = 0;
+  int resyncInterval = 1000;
+  int sweepsSinceResync = 0;
+
+  struct Delta {
+    double e = 0, mx = 0, my = 0;
+    long accepted = 0;
+  };
+  std::vector<Delta> rowDeltas;
+
+  // XYLattice::Row.
+  struct Row {
+    int base = 0;
+    int parity = 0;
+    std::array<int, 2 * (D - 1)> offsets{};
+  };
+
+  int forward(int d, int c) const { return c + 1 == L[d] ? 0 : c + 1; }
+  int backward(int d, int c) const { return c == 0 ? L[d] - 1 : c - 1; }
+
+  Row row(int r) const {
+    Row row;
+    for (int d = 1; d < D; d++) {
+      int c = r % L[d];
+      r /= L[d];
+      row.base += c * stride[d];
+      row.parity += c;
+      row.offsets[2 * (d - 1)] = (forward(d, c) - c) * stride[d];
+      row.offsets[2 * (d - 1) + 1] = (backward(d, c) - c) * stride[d];
+    }
+    row.parity &= 1;
+    return row;
+  }
+
+  int rows() const { return volume / L[0]; }
+
+  std::array<int, 2 * D> neighbors(const Row& row, int x) const {
+    int s = row.base + x;
+    std::array<int, 2 * D> nb;
+    nb[0] = row.base + forward(0, x);
+    nb[1] = row.base + backward(0, x);
+    for (int k = 0; k < 2 * (D - 1); k++) nb[2 + k] = s + row.offsets[k];
+    return nb;
+  }
+
+  void forRows(const std::function<void(int begin, int end, int tid)>& f) {
+    if (pool) pool->parallelFor(rows(), f); else f(0, rows(), 0);
+  }
+
+  // exp(cosine / T) over the 2D bonds of a site stays below 1e300 for
+  // T > 2 D / 690, i.e. T > 0.012 in 4D.
+  void prepareWeights() {
+    if (weightT == T) return;
+    weight.resize(q);
+    for (int n = 0; n < q; n++) weight[n] = std::exp(cosine[n] / T);
+    weightT = T;
+  }
+
+  unsigned nextGeneration() {
+    if (++generation == 0) {
+      std::fill(visited.begin(), visited.end(), 0);
+      generation = 1;
+    }
+    return generation;
+  }
+
+  void apply(const Delta& d) {
+    energySum += d.e;
+    mxSum += d.mx;
+    mySum += d.my;
+    if constexpr (telemetry::enabled) stats.accepted += d.accepted;
+  }
+
+  void countSweep() {
+    if constexpr (telemetry::enabled) stats.sweeps++;
+    if (++sweepsSinceResync >= resyncInterval) resync();
+  }
+
+  double random() { return rand(rng); }
+
+  // XYLattice::metropolisStep with a rotation by delta levels. The
+  // acceptance test u < exp(-dE / T) becomes a comparison of products of
+  // bond weights, u * prod w(now) < prod w(after).
+  void metropolisStep(int s, const std::array<int, 2 * D>& nb, int delta, double u, Delta& d) {
+    const int now = spins[s], moved = (now + delta) & mask;
+    double energy_now = 0, energy_after = 0, weight_now = 1, weight_after = 1;
+    for (int n : nb) {
+      int a = (now - spins[n]) & mask, b = (moved - spins[n]) & mask;
+      energy_now -= cosine[a];
+      energy_after -= cosine[b];
+      weight_now *= weight[a];
+      weight_after *= weight[b];
+    }
+
+    if (u * weight_now < weight_after) {
+      spins[s] = static_cast<Level>(moved);
+      d.e += energy_after - energy_now;
+      d.mx += cosine[moved] - cosine[now];
+      d.my += sine[moved] - sine[now];
+      if constexpr (telemetry::enabled) d.accepted++;
+    }
+  }
+
+  void metropolisRow(const Row& row, int start, Delta& d) {
+    for (int x = start; x < L[0]; x += 2) {
+      int s = row.base + x;
+      double delta, u;
+      siteStream.uniforms(streamSweeps, s, 0, delta, u);
+      metropolisStep(s, neighbors(row, x), static_cast<int>(delta * q), u, d);
+    }
+  }
+
+public:
+  std::vector<Level> spins;
+  float T = 1.0;
+
+  template <std::integral... Ns>
+    requires (sizeof...(Ns) == D)
+  explicit ClockLattice(int levels, Ns... n) : L{static_cast<int>(n)...}, q(levels), mask(levels - 1) {
+    if (q < 2 || q > 1 << 16 || (q & mask)) {
+      throw std::invalid_argument("ClockLattice needs a power of two between 2 and 65536 levels");
+    }
+    for (int d = 0; d < D; d++) {
+      if (L[d] % 2) throw std::invalid_argument("ClockLattice needs even extents for the checkerboard");
+      stride[d] = volume;
+      volume *= L[d];
+    }
+    cosine.resize(q);
+    sine.resize(q);
+    half.resize(2 * q);
+    for (int i = 0; i < q; i++) {
+      cosine[i] = std::cos(2 * M_PI * i / q);
+      sine[i] = std::sin(2 * M_PI * i / q);
+    }
+    for (int j = 0; j < 2 * q; j++) half[j] = std::cos(M_PI * j / q);
+
+    std::random_device device;
+    seed((static_cast<uint64_t>(device()) << 32) | device());
+    spins.assign(volume, 0);
+    visited.assign(volume, 0);
+    stack.reserve(std::min(volume, 1 << 16));
+    resync();
+  }
+
+  // As XYLattice::seed.
+  void seed(uint64_t seed, uint64_t stream = 0) {
+    uint64_t key = prng::streamKey(seed, stream);
+    if constexpr (std::constructible_from<Rng, uint64_t, uint64_t>) {
+      rng = Rng(seed, stream);
+    } else {
+      rng = Rng(static_cast<typename Rng::result_type>(key));
+    }
+    siteStream = prng::SiteStream(prng::streamKey(key, 1));
+    streamSweeps = 0;
+  }
+
+  int levels() const { return q; }
+  int size() const { return volume; }
+  int extent(int d) const { return L[d]; }
+  int clustersLastSweep() const { return wolffClusters; }
+
+  const telemetry::UpdateStats& updateStats() const { return stats; }
+  telemetry::UpdateStats takeStats() { return std::exchange(stats, {}); }
+
+  // Threads used by Metropolis(), split over rows as in XYLattice.
+  void setThreads(int threads) {
+    threads = std::max(threads, 1);
+    pool = threads > 1 ? std::make_unique<ThreadPool>(threads) : nullptr;
+  }
+
+  int threads() const { return pool ? pool->size() : 1; }
+
+  void initializeData(bool aligned = false) {
+    if (aligned) {
+      std::fill(spins.begin(), spins.end(), static_cast<Level>(random() * q));
+    } else {
+      std::generate(spins.begin(), spins.end(), [this] { return static_cast<Level>(random() * q); });
+    }
+    resync();
+  }
+
+  // The spins as angles in [0, 2 pi), and back, rounded to the nearest level
+  // (followed by resync()).
+  std::vector<double> angles() const {
+    std::vector<double> result(volume);
+    for (int s = 0; s < volume; s++) result[s] = 2 * M_PI * spins[s] / q;
+    return result;
+  }
+
+  void setAngles(const std::vector<double>& values) {
+    for (int s = 0; s < volume; s++) {
+      spins[s] = static_cast<Level>(static_cast<long>(std::lround(values[s] * q / (2 * M_PI))) & mask);
+    }
+    resync();
+  }
+
+  void resync() {
+    mxSum = mySum = 0;
+    for (Level spin : spins) {
+      mxSum += cosine[spin];
+      mySum += sine[spin];
+    }
+    energySum = Energy() * volume;
+    sweepsSinceResync = 0;
+  }
+
+  void setResyncInterval(int sweeps) { resyncInterval = std::max(sweeps, 1); }
+
+  double currentEnergy() const { return energySum / volume; }
+  double currentMagnetization() const { return std::hypot(mxSum, mySum) / volume; }
+  double currentMx() const { return mxSum / volume; }
+  double currentMy() const { return mySum / volume; }
+
+  double Magnetization() const {
+    double sumX = 0, sumY = 0;
+    for (Level spin : spins) {
+      sumX += cosine[spin];
+      sumY += sine[spin];
+    }
+    return std::hypot(sumX, sumY) / volume;
+  }
+
+  // Every bond once, through the +1 neighbour on each axis.
+  double Energy() const {
+    double sum = 0;
+    for (int r = 0; r < rows(); r++) {
+      Row current = row(r);
+      for (int x = 0; x < L[0]; x++) {
+        int s = current.base + x;
+        sum -= cosine[(spins[s] - spins[current.base + forward(0, x)]) & mask];
+        for (int d = 1; d < D; d++) sum -= cosine[(spins[s] - spins[s + current.offsets[2 * (d - 1)]]) & mask];
+      }
+    }
+    return sum / volume;
+  }
+
+  // Checkerboard sweep with uniformly drawn rotations; as XYLattice's, the
+  // same for any thread count.
+  void Metropolis() {
+    if constexpr (telemetry::enabled) stats.attempts += volume;
+    prepareWeights();
+    rowDeltas.assign(rows(), Delta{});
+    for (int color = 0; color < 2; color++) {
+      forRows([&](int begin, int end, int) {
+        for (int r = begin; r < end; r++) {
+          Row current = row(r);
+          metropolisRow(current, (current.parity + color) & 1, rowDeltas[r]);
+        }
+      });
+    }
+    for (const auto& d : rowDeltas) apply(d);
+    streamSweeps++;
+    countSweep();
+  }
+
+  // XYLattice::Wolff with reflections about one of the 2q axes that map the
+  // levels onto each other, perpendicular to the direction m / 2 levels from
+  // 0: n -> m + q / 2 - n. Projections
+  // come from the table; the bond probability depends on two of them, so its
+  // exponential is still computed.
+  // XYLattice::wolffBudget.
+  int wolffBudget() {
+    if (T != wolffT) {
+      wolffT = T;
+      wolffSites = 0;
+      wolffCount = 0;
+    }
+    if (wolffCount == 0) return 1;
+    return std::max(1, static_cast<int>(std::ceil(volume * wolffCount / wolffSites)));
+  }
+
+  void Wolff() {
+    const int clusters = wolffBudget();
+    int flippedSpins = 0;
+    const int axes = 2 * q - 1;
+
+    for (int i = 0; i < clusters; i++) {
+      const int m = static_cast<int>(random() * 2 * q);
+      unsigned stamp = nextGeneration();
+      int clusterSize = 0;
+      double projSum = 0;
+
+      Site seed{static_cast<int>(random() * volume), {}};
+      for (int d = 0, rest = seed.index; d < D; d++) {
+        seed.x[d] = rest % L[d];
+        rest /= L[d];
+      }
+      visited[seed.index] = stamp;
+      stack.push_back(seed);
+
+      while (!stack.empty()) {
+        Site site = stack.back();
+        stack.pop_back();
+        int s = site.index;
+
+        double proj = half[(m - 2 * spins[s]) & axes];
+        spins[s] = static_cast<Level>((m + q / 2 - spins[s]) & mask);
+
+        for (int d = 0; d < D; d++) {
+          int c = site.x[d];
+          for (int next : {forward(d, c), backward(d, c)}) {
+            Site neighbor = site;
+            neighbor.x[d] = next;
+            neighbor.index = s + (next - c) * stride[d];
+
+            double projNeighbor = half[(m - 2 * spins[neighbor.index]) & axes];
+            energySum += 2 * proj * projNeighbor;
+            if (
+              visited[neighbor.index] != stamp &&
+              (random() < 1 - std::exp(std::min(0.0, -2 / T * proj * projNeighbor)))
+            ) {
+              visited[neighbor.index] = stamp;
+              stack.push_back(neighbor);
+            }
+          }
+        }
+        projSum += proj;
+        clusterSize++;
+      }
+      // cos and sin of the axis angle pi m / q.
+      mxSum -= 2 * projSum * half[m];
+      mySum -= 2 * projSum * half[(m - q / 2) & axes];
+
+      flippedSpins += clusterSize;
+      if constexpr (telemetry::enabled) stats.addCluster(clusterSize);
+    }
+    wolffSites += flippedSpins;
+    wolffCount += clusters;
+    wolffClusters = clusters;
+    if constexpr (telemetry::enabled) stats.wolffSweeps++;
+    countSweep();
+  }
+};
+
+using ClockModel = ClockLattice<2>;
+using ClockModel3D = ClockLattice<3>;
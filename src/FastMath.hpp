@@ -0,0 +1,89 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <bit>
+#include <algorithm>
+
+// Branch-free polynomial approximations of cos, sin and exp. They contain no
+// calls and no lookups, so loops over arrays of doubles using them are
+// vectorized by the compiler (AVX2 / AVX-512 under -march=native).
+namespace fastmath {
+
+// Adding and subtracting 1.5 * 2^52 rounds to the nearest integer without
+// a call to nearbyint, and leaves that integer in the low mantissa bits.
+inline constexpr double ROUND_MAGIC = 0x1.8p52;
+
+inline constexpr double TWO_PI_HI = 6.28318530717958623200e+00;
+inline constexpr double TWO_PI_LO = 2.44929359829470635445e-16;
+inline constexpr double INV_TWO_PI = 0.15915494309189533577;
+
+// Reduces x to [-pi, pi].
+inline double reduceAngle(double x) {
+  double k = (x * INV_TWO_PI + ROUND_MAGIC) - ROUND_MAGIC;
+  return (x - k * TWO_PI_HI) - k * TWO_PI_LO;
+}
+
+// Taylor series to x^20 on [-pi, pi]: absolute error below 1e-10.
+inline double cos(double x) {
+  x = reduceAngle(x);
+  double y = x * x;
+  double p = 1.0 / 2432902008176640000.0;  // 1/20!
+  p = p * y - 1.0 / 6402373705728000.0;
+  p = p * y + 1.0 / 20922789888000.0;
+  p = p * y - 1.0 / 87178291200.0;
+  p = p * y + 1.0 / 479001600.0;
+  p = p * y - 1.0 / 3628800.0;
+  p = p * y + 1.0 / 40320.0;
+  p = p * y - 1.0 / 720.0;
+  p = p * y + 1.0 / 24.0;
+  p = p * y - 0.5;
+  return p * y + 1.0;
+}
+
+// Taylor series to x^21 on [-pi, pi]: absolute error below 1e-10.
+inline double sin(double x) {
+  x = reduceAngle(x);
+  double y = x * x;
+  double p = 1.0 / 51090942171709440000.0;  // 1/21!
+  p = p * y - 1.0 / 121645100408832000.0;
+  p = p * y + 1.0 / 355687428096000.0;
+  p = p * y - 1.0 / 1307674368000.0;
+  p = p * y + 1.0 / 6227020800.0;
+  p = p * y - 1.0 / 39916800.0;
+  p = p * y + 1.0 / 362880.0;
+  p = p * y - 1.0 / 5040.0;
+  p = p * y + 1.0 / 120.0;
+  p = p * y - 1.0 / 6.0;
+  return (p * y + 1.0) * x;
+}
+
+// exp(x) for x <= 0 as 2^k * exp(r), |r| <= ln(2)/2, with a degree-11
+// Taylor polynomial: relative error below 1e-14. Arguments below -708 are
+// clamped, which only matters as "practically zero" for acceptance tests.
+inline double expNegative(double x) {
+  constexpr double LOG2E = 1.44269504088896338700;
+  constexpr double LN2_HI = 6.93147180369123816490e-01;
+  constexpr double LN2_LO = 1.90821492927058770002e-10;
+
+  x = std::clamp(x, -708.0, 0.0);
+  double kd = x * LOG2E + ROUND_MAGIC;
+  int64_t k = std::bit_cast<int64_t>(kd) - std::bit_cast<int64_t>(ROUND_MAGIC);
+  kd -= ROUND_MAGIC;
+  double r = (x - kd * LN2_HI) - kd * LN2_LO;
+
+  double p = 1.0 / 39916800.0;  // 1/11!
+  p = p * r + 1.0 / 3628800.0;
+  p = p * r + 1.0 / 362880.0;
+  p = p * r + 1.0 / 40320.0;
+  p = p * r + 1.0 / 5040.0;
+  p = p * r + 1.0 / 720.0;
+  p = p * r + 1.0 / 120.0;
+  p = p * r + 1.0 / 24.0;
+  p = p * r + 1.0 / 6.0;
+  p = p * r + 0.5;
+  p = p * r + 1.0;
+  p = p * r + 1.0;
+  return p * std::bit_cast<double>((k + 1023) << 52);
+}
+
+}  // namespace fastmath
@@ -0,0 +1,158 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <concepts>
+#include <stdexcept>
+#include <utility>
+
+// Measures configurations on a thread of its own, so that the next sweep
+// starts as soon as the spins are copied. push() copies the spins into one
+// of a fixed set of depth buffers and returns; the worker runs Measure() on
+// them (energy, magnetization, helicity sums, vortices) in the order they
+// were pushed and adds them up. When every buffer is still waiting to be
+// measured, push() blocks until the worker frees one, so memory stays at
+// depth copies of the lattice however far the updates get ahead. depth = 2
+// is a double buffer: one configuration measured while the next is swept.
+template <typename Lattice>
+class MeasurementPipeline {
+public:
+  using Measurement = typename Lattice::Measurement;
+
+  // Means over the configurations measured since the last take(), per site
+  // as in Measurement; bondSin2 is the mean of bondSin^2.
+  struct Averages {
+    double e = 0, m = 0, e2 = 0, m2 = 0, vortices = 0;
+    decltype(Measurement::bondCos) bondCos{}, bondSin2{};
+    std::vector<double> eSeries, mSeries;
+    int samples = 0;
+
+    // Helicity modulus averaged over the axes; see Lattice::helicity.
+    double helicity(int volume, double T) const {
+      double sum = 0;
+      for (size_t d = 0; d < bondCos.size(); d++) sum += Lattice::helicity(bondCos[d], bondSin2[d], volume, T);
+      return sum / bondCos.size();
+    }
+  };
+
+private:
+  Lattice probe;
+  bool series;
+  std::vector<std::vector<double>> buffers;
+  std::vector<int> spare;
+  std::deque<int> queued;
+  Averages sums;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  bool stopping = false;
+  std::thread worker;
+
+  void add(const Measurement& x) {
+    double m = x.magnetization();
+    sums.e += x.energy;
+    sums.m += m;
+    sums.e2 += x.energy * x.energy;
+    sums.m2 += m * m;
+    sums.vortices += x.vortices;
+    for (size_t d = 0; d < x.bondCos.size(); d++) {
+      sums.bondCos[d] += x.bondCos[d];
+      sums.bondSin2[d] += x.bondSin[d] * x.bondSin[d];
+    }
+    if (series) {
+      sums.eSeries.push_back(x.energy);
+      sums.mSeries.push_back(m);
+    }
+    sums.samples++;
+  }
+
+  // A queued buffer belongs to the worker until it is back in spare, so it
+  // can be measured without holding the lock.
+  void loop() {
+    while (true) {
+      int b;
+      {
+        std::unique_lock lock(mutex);
+        wake.wait(lock, [&] { return stopping || !queued.empty(); });
+        if (queued.empty()) return;
+        b = queued.front();
+      }
+      std::swap(probe.spins, buffers[b]);
+      Measurement x = probe.Measure();
+      std::swap(probe.spins, buffers[b]);
+      add(x);
+      {
+        std::lock_guard lock(mutex);
+        queued.pop_front();
+        spare.push_back(b);
+      }
+      done.notify_all();
+    }
+  }
+
+public:
+  // A pipeline for lattices of extents n, with depth buffers. With series,
+  // take() also returns E and M of every configuration.
+  template <std::integral... Ns>
+  explicit MeasurementPipeline(int depth, bool series_, Ns... n) : probe(n...), series(series_) {
+    if (depth < 1) throw std::invalid_argument("MeasurementPipeline needs at least one buffer");
+    buffers.resize(depth);
+    for (int b = depth - 1; b >= 0; b--) spare.push_back(b);
+    worker = std::thread([this] { loop(); });
+  }
+
+  MeasurementPipeline(const MeasurementPipeline&) = delete;
+  MeasurementPipeline& operator=(const MeasurementPipeline&) = delete;
+
+  // Measures whatever is still queued, then stops the worker.
+  ~MeasurementPipeline() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+  }
+
+  int depth() const { return static_cast<int>(buffers.size()); }
+
+  // Queues xy's current configuration, waiting for a free buffer first. The
+  // copy reuses the buffer's memory, so after the first round no sweep
+  // allocates.
+  void push(const Lattice& xy) {
+    if (xy.size() != probe.size()) throw std::invalid_argument("MeasurementPipeline: lattice size does not match");
+    int b;
+    {
+      std::unique_lock lock(mutex);
+      done.wait(lock, [&] { return !spare.empty(); });
+      b = spare.back();
+      spare.pop_back();
+    }
+    buffers[b].assign(xy.spins.begin(), xy.spins.end());
+    {
+      std::lock_guard lock(mutex);
+      queued.push_back(b);
+    }
+    wake.notify_one();
+  }
+
+  // Waits until everything pushed so far is measured, and returns the means
+  // over it, starting over for the next point.
+  Averages take() {
+    {
+      std::unique_lock lock(mutex);
+      done.wait(lock, [&] { return queued.empty(); });
+    }
+    Averages result = std::exchange(sums, Averages{});
+    if (result.samples > 0) {
+      const double n = result.samples;
+      for (double* v : {&result.e, &result.m, &result.e2, &result.m2, &result.vortices}) *v /= n;
+      for (size_t d = 0; d < result.bondCos.size(); d++) {
+        result.bondCos[d] /= n;
+        result.bondSin2[d] /= n;
+      }
+    }
+    return result;
+  }
+};
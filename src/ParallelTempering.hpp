@@ -0,0 +1,157 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include "ThreadPool.hpp"
+#include "Random.hpp"
+
+// Replica exchange over a temperature ladder. replica(t) always runs at
+// temperature(t); an accepted exchange swaps the spin configurations of two
+// neighbouring replicas rather than their temperatures. Replicas are swept
+// concurrently on a thread pool.
+template <typename Model>
+class ParallelTempering {
+private:
+  std::vector<Model> replicas;
+  std::vector<double> T;
+  std::vector<long> attempts, accepted;  // per pair (t, t + 1)
+  ThreadPool pool;
+  prng::Xoshiro256pp rng;
+  int parity = 0;
+
+  double uniform() { return prng::toUnit(rng()); }
+
+public:
+  // make(t) builds the replica for temperature T[t]; T is sorted ascending.
+  template <typename Factory>
+  ParallelTempering(std::vector<double> T_, int threads, uint64_t seed, Factory make)
+      : T(std::move(T_)), pool(threads), rng(seed) {
+    std::sort(T.begin(), T.end());
+    replicas.reserve(T.size());
+    for (int t = 0; t < static_cast<int>(T.size()); t++) {
+      replicas.push_back(make(t));
+      replicas.back().T = T[t];
+    }
+    attempts.assign(std::max<int>(T.size() - 1, 0), 0);
+    accepted.assign(attempts.size(), 0);
+  }
+
+  int size() const { return static_cast<int>(replicas.size()); }
+  Model& replica(int t) { return replicas[t]; }
+  double temperature(int t) const { return T[t]; }
+  const std::vector<double>& temperatures() const { return T; }
+
+  // Runs algo(replica) n times on every replica, replicas spread over the pool.
+  void sweep(const std::function<void(Model&)>& algo, int n = 1) {
+    pool.parallelFor(size(), [&](int begin, int end, int) {
+      for (int t = begin; t < end; t++) {
+        for (int i = 0; i < n; i++) algo(replicas[t]);
+      }
+    });
+  }
+
+  // Metropolis exchange between neighbouring temperatures, even and odd
+  // pairs on alternating calls: accept with min(1, exp(dBeta * dE)).
+  void exchange() {
+    for (int t = parity; t + 1 < size(); t += 2) {
+      double dBeta = 1.0 / T[t] - 1.0 / T[t + 1];
+      double dE = (replicas[t].currentEnergy() - replicas[t + 1].currentEnergy()) * replicas[t].size();
+      attempts[t]++;
+      if (dBeta * dE >= 0 || uniform() < std::exp(dBeta * dE)) {
+        replicas[t].exchange(replicas[t + 1]);
+        accepted[t]++;
+      }
+    }
+    parity ^= 1;
+  }
+
+  double acceptanceRate(int t) const {
+    return attempts[t] ? static_cast<double>(accepted[t]) / attempts[t] : 0.0;
+  }
+
+  std::vector<double> acceptanceRates() const {
+    std::vector<double> rates(attempts.size());
+    for (int t = 0; t < static_cast<int>(rates.size()); t++) rates[t] = acceptanceRate(t);
+    return rates;
+  }
+
+  void resetStatistics() {
+    std::fill(attempts.begin(), attempts.end(), 0);
+    std::fill(accepted.begin(), accepted.end(), 0);
+  }
+
+  // Moves the interior temperatures towards equal acceptance on every pair,
+  // keeping both ends fixed. Each gap in beta is given the length
+  // sqrt(-ln a), which for Gaussian energy histograms grows linearly with
+  // the gap, and the points are re-spaced evenly in that length; damping
+  // mixes the result with the old ladder. Statistics are reset afterwards.
+  void adaptLadder(double damping = 0.5) {
+    if (size() < 3) return;
+    std::vector<double> beta(size()), length(size(), 0.0);
+    for (int t = 0; t < size(); t++) beta[t] = 1.0 / T[t];
+    for (int t = 0; t + 1 < size(); t++) {
+      double a = std::clamp(acceptanceRate(t), 1e-4, 1 - 1e-4);
+      length[t + 1] = length[t] + std::sqrt(-std::log(a));
+    }
+
+    std::vector<double> next = beta;
+    for (int t = 1, k = 0; t + 1 < size(); t++) {
+      double target = length.back() * t / (size() - 1);
+      while (length[k + 1] < target) k++;
+      double f = (target - length[k]) / (length[k + 1] - length[k]);
+      next[t] = damping * beta[t] + (1 - damping) * (beta[k] + f * (beta[k + 1] - beta[k]));
+    }
+
+    for (int t = 0; t < size(); t++) {
+      T[t] = 1.0 / next[t];
+      replicas[t].T = T[t];
+    }
+    resetStatistics();
+  }
+};
+
+// Per-temperature averages of E, M, E^2 and M^2 (per site), as collected by
+// the drivers' sampling loops, and optionally the per-sweep series.
+struct TemperingAverages {
+  std::vector<double> e, m, e2, m2;
+  std::vector<double> swapRates;
+  std::vector<std::vector<double>> eSeries, mSeries;  // [T][step]
+};
+
+// burn sweeps to equilibrate, then steps measured sweeps, each followed by
+// one round of exchanges. Swap statistics cover the measured sweeps only.
+template <typename Model, typename Algo>
+TemperingAverages sampleTempering(ParallelTempering<Model>& pt, Algo algo, int burn, int steps, bool keepSeries = false) {
+  int n = pt.size();
+  TemperingAverages avg{std::vector(n, 0.0), std::vector(n, 0.0), std::vector(n, 0.0), std::vector(n, 0.0), {}, {}, {}};
+  if (keepSeries) {
+    avg.eSeries.assign(n, std::vector(steps, 0.0));
+    avg.mSeries.assign(n, std::vector(steps, 0.0));
+  }
+
+  for (int i = 0; i < burn; i++) {
+    pt.sweep(algo);
+    pt.exchange();
+  }
+  pt.resetStatistics();
+
+  for (int i = 0; i < steps; i++) {
+    pt.sweep(algo);
+    pt.exchange();
+    for (int t = 0; t < n; t++) {
+      double _e = pt.replica(t).currentEnergy();
+      double _m = pt.replica(t).currentMagnetization();
+      avg.e[t] += _e / steps;
+      avg.m[t] += _m / steps;
+      avg.e2[t] += _e * _e / steps;
+      avg.m2[t] += _m * _m / steps;
+      if (keepSeries) {
+        avg.eSeries[t][i] = _e;
+        avg.mSeries[t][i] = _m;
+      }
+    }
+  }
+  avg.swapRates = pt.acceptanceRates();
+  return avg;
+}
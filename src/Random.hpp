@@ -0,0 +1,124 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <cmath>
+#include <iostream>
+
+// Random number generation for the models, everything explicitly seeded.
+// Xoshiro256pp is the sequential generator (32 bytes of state instead of
+// mt19937's 2.5 KB); Philox4x32 is counter-based, so a site's random numbers
+// in a given sweep depend only on (key, sweep, site) and not on which thread
+// or in which order the site is updated.
+namespace prng {
+
+inline uint64_t splitmix64(uint64_t& state) {
+  uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+// Derives an independent 64-bit key from a seed and a stream number
+// (replica, repetition, grid point, ...).
+inline uint64_t streamKey(uint64_t seed, uint64_t stream) {
+  uint64_t state = seed;
+  uint64_t a = splitmix64(state);
+  state = a ^ stream;
+  return splitmix64(state);
+}
+
+// 53 random bits to a double in [0, 1).
+inline double toUnit(uint64_t bits) { return static_cast<double>(bits >> 11) * 0x1.0p-53; }
+
+inline double toUnit(uint32_t hi, uint32_t lo) {
+  return toUnit((static_cast<uint64_t>(hi) << 32) | lo);
+}
+
+// xoshiro256++ (Blackman & Vigna). Satisfies UniformRandomBitGenerator.
+class Xoshiro256pp {
+private:
+  std::array<uint64_t, 4> s;
+
+  static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+public:
+  using result_type = uint64_t;
+  using State = std::array<uint64_t, 4>;
+
+  explicit Xoshiro256pp(uint64_t seed = 0, uint64_t stream = 0) {
+    uint64_t state = streamKey(seed, stream);
+    for (auto& word : s) word = splitmix64(state);
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+  result_type operator()() {
+    uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+  }
+
+  const State& state() const { return s; }
+  void setState(const State& state) { s = state; }
+
+  // Text form, like the standard engines, for checkpoints.
+  friend std::ostream& operator<<(std::ostream& os, const Xoshiro256pp& g) {
+    return os << g.s[0] << ' ' << g.s[1] << ' ' << g.s[2] << ' ' << g.s[3];
+  }
+
+  friend std::istream& operator>>(std::istream& is, Xoshiro256pp& g) {
+    return is >> g.s[0] >> g.s[1] >> g.s[2] >> g.s[3];
+  }
+};
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3"). Stateless: four 32-bit outputs per (counter, key). Written without
+// branches or calls so loops over it vectorize.
+struct Philox4x32 {
+  using Counter = std::array<uint32_t, 4>;
+
+  static Counter generate(Counter c, uint32_t k0, uint32_t k1) {
+    constexpr uint64_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+    constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+    for (int round = 0; round < 10; round++) {
+      uint64_t p0 = M0 * c[0];
+      uint64_t p1 = M1 * c[2];
+      c = {
+        static_cast<uint32_t>(p1 >> 32) ^ c[1] ^ k0,
+        static_cast<uint32_t>(p1),
+        static_cast<uint32_t>(p0 >> 32) ^ c[3] ^ k1,
+        static_cast<uint32_t>(p0),
+      };
+      k0 += W0;
+      k1 += W1;
+    }
+    return c;
+  }
+};
+
+// Per-site random numbers for a sweep: two uniforms in [0, 1) from one
+// Philox call on (site, sweep). This is also the bulk path: the vectorized
+// kernels draw for a whole row of sites in one loop over it.
+struct SiteStream {
+  uint32_t k0 = 0, k1 = 0;
+
+  SiteStream() = default;
+  explicit SiteStream(uint64_t key) : k0(static_cast<uint32_t>(key)), k1(static_cast<uint32_t>(key >> 32)) {}
+
+  void uniforms(uint64_t sweep, uint32_t site, uint32_t tag, double& a, double& b) const {
+    auto r = Philox4x32::generate(
+      {site, static_cast<uint32_t>(sweep), static_cast<uint32_t>(sweep >> 32), tag}, k0, k1);
+    a = toUnit(r[0], r[1]);
+    b = toUnit(r[2], r[3]);
+  }
+};
+
+}  // namespace prng
@@ -0,0 +1,295 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <random>
+#include <cmath>
+#include <memory>
+#include <concepts>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+#include <functional>
+#include "ThreadPool.hpp"
+#include "FastMath.hpp"
+#include "Random.hpp"
+#include "Telemetry.hpp"
+
+// K independent replicas of an XY lattice, stored interleaved: spins[K * s + k]
+// is site s of replica k. A Metropolis sweep updates the same site in all K
+// replicas at once, so the loop over replicas is one or two vector
+// operations (K = 8: one AVX-512 register) with contiguous loads, and the
+// stencil, colour and loop
+// overhead of a site is paid once per K replicas. For the many repetitions
+// of small lattices in finite-size scaling, where a single lattice has too
+// few sites per row to keep the vector units busy.
+//
+// Each replica has its own seed, stream and temperature, and draws its
+// numbers as an XYLattice with setVectorized(true) does, with the same
+// arithmetic: replica k goes through the configurations of an XYLattice
+// seeded alike, with the same running totals. Checkerboard Metropolis only,
+// so the extents must be even.
+template <int D, int K = 8, typename Rng = prng::Xoshiro256pp>
+class ReplicaLattice {
+  static_assert(D >= 2 && D <= 4, "ReplicaLattice supports 2, 3 and 4 dimensions");
+  static_assert(K >= 1, "ReplicaLattice needs at least one replica");
+
+private:
+  std::array<Rng, K> rng;
+  // The per-site stream keys of the replicas, split into the two Philox key
+  // words so that the draws of all replicas vectorize like the update.
+  std::array<uint32_t, K> key0{}, key1{};
+  uint64_t streamSweeps = 0;
+  std::uniform_real_distribution<double> randPI{0.0, 2 * M_PI};
+  std::array<int, D> L;
+  std::array<int, D> stride;
+  int volume = 1;
+
+  std::unique_ptr<ThreadPool> pool;
+  telemetry::UpdateStats stats;
+
+  // Running totals per replica, as in XYLattice.
+  std::array<double, K> energySum{}, mxSum{}, mySum{};
+  int resyncInterval = 1000;
+  int sweepsSinceResync = 0;
+
+  struct Delta {
+    std::array<double, K> e{}, mx{}, my{};
+    long accepted = 0;
+  };
+  std::vector<Delta> rowDeltas;
+
+  // XYLattice::Row.
+  struct Row {
+    int base = 0;
+    int parity = 0;
+    std::array<int, 2 * (D - 1)> offsets{};
+  };
+
+  int forward(int d, int c) const { return c + 1 == L[d] ? 0 : c + 1; }
+  int backward(int d, int c) const { return c == 0 ? L[d] - 1 : c - 1; }
+
+  Row row(int r) const {
+    Row row;
+    for (int d = 1; d < D; d++) {
+      int c = r % L[d];
+      r /= L[d];
+      row.base += c * stride[d];
+      row.parity += c;
+      row.offsets[2 * (d - 1)] = (forward(d, c) - c) * stride[d];
+      row.offsets[2 * (d - 1) + 1] = (backward(d, c) - c) * stride[d];
+    }
+    row.parity &= 1;
+    return row;
+  }
+
+  int rows() const { return volume / L[0]; }
+
+  std::array<int, 2 * D> neighbors(const Row& row, int x) const {
+    int s = row.base + x;
+    std::array<int, 2 * D> nb;
+    nb[0] = row.base + forward(0, x);
+    nb[1] = row.base + backward(0, x);
+    for (int k = 0; k < 2 * (D - 1); k++) nb[2 + k] = s + row.offsets[k];
+    return nb;
+  }
+
+  void forRows(const std::function<void(int begin, int end, int tid)>& f) {
+    if (pool) pool->parallelFor(rows(), f); else f(0, rows(), 0);
+  }
+
+  void countSweep() {
+    if constexpr (telemetry::enabled) stats.sweeps += K;
+    if (++sweepsSinceResync >= resyncInterval) resync();
+  }
+
+  // XYLattice::metropolisRowSimd with the replicas as the vector lanes.
+  void metropolisRow(const Row& row, int start, Delta& d) {
+    std::array<double, K> beta;
+    for (int k = 0; k < K; k++) beta[k] = 1.0 / T[k];
+
+    for (int x = start; x < L[0]; x += 2) {
+      const int s = row.base + x;
+      const auto nb = neighbors(row, x);
+      alignas(64) double theta[K], neighbor[2 * D][K], delta[K], u[K], out[K], de[K], dmx[K], dmy[K];
+      for (int k = 0; k < K; k++) theta[k] = spins[K * s + k];
+      for (int j = 0; j < 2 * D; j++) {
+        for (int k = 0; k < K; k++) neighbor[j][k] = spins[K * nb[j] + k];
+      }
+      const uint32_t lo = static_cast<uint32_t>(streamSweeps), hi = static_cast<uint32_t>(streamSweeps >> 32);
+      for (int k = 0; k < K; k++) {
+        auto r = prng::Philox4x32::generate({static_cast<uint32_t>(s), lo, hi, 0}, key0[k], key1[k]);
+        delta[k] = 2 * M_PI * prng::toUnit(r[0], r[1]);
+        u[k] = prng::toUnit(r[2], r[3]);
+      }
+
+      for (int k = 0; k < K; k++) {
+        double moved = theta[k] + delta[k];
+        double energy_now = 0, energy_after = 0;
+        // Unrolled, so that the loop over replicas vectorizes in 3D and 4D too.
+#pragma GCC unroll 8
+        for (int j = 0; j < 2 * D; j++) {
+          energy_now -= fastmath::cos(theta[k] - neighbor[j][k]);
+          energy_after -= fastmath::cos(moved - neighbor[j][k]);
+        }
+        double dE = energy_after - energy_now;
+        bool accept = (dE < 0) | (u[k] < fastmath::expNegative(-dE * beta[k]));
+        double wrapped = moved >= 2 * M_PI ? moved - 2 * M_PI : moved;
+        out[k] = accept ? wrapped : theta[k];
+        de[k] = accept ? dE : 0.0;
+        dmx[k] = accept ? fastmath::cos(wrapped) - fastmath::cos(theta[k]) : 0.0;
+        dmy[k] = accept ? fastmath::sin(wrapped) - fastmath::sin(theta[k]) : 0.0;
+      }
+
+      for (int k = 0; k < K; k++) {
+        spins[K * s + k] = out[k];
+        d.e[k] += de[k];
+        d.mx[k] += dmx[k];
+        d.my[k] += dmy[k];
+        if constexpr (telemetry::enabled) d.accepted += out[k] != theta[k];
+      }
+    }
+  }
+
+public:
+  std::vector<double> spins;
+  std::array<float, K> T;
+
+  template <std::integral... Ns>
+    requires (sizeof...(Ns) == D)
+  explicit ReplicaLattice(Ns... n) : L{static_cast<int>(n)...} {
+    for (int d = 0; d < D; d++) {
+      if (L[d] % 2) throw std::invalid_argument("ReplicaLattice needs even extents for the checkerboard");
+      stride[d] = volume;
+      volume *= L[d];
+    }
+    T.fill(1.0f);
+    spins.assign(static_cast<size_t>(K) * volume, 0.0);
+    std::random_device device;
+    for (int k = 0; k < K; k++) seed(k, (static_cast<uint64_t>(device()) << 32) | device());
+    resync();
+  }
+
+  // As XYLattice::seed, for replica k. All replicas sweep together, so this
+  // also restarts the site stream of the others.
+  void seed(int k, uint64_t seed, uint64_t stream = 0) {
+    uint64_t key = prng::streamKey(seed, stream);
+    if constexpr (std::constructible_from<Rng, uint64_t, uint64_t>) {
+      rng[k] = Rng(seed, stream);
+    } else {
+      rng[k] = Rng(static_cast<typename Rng::result_type>(key));
+    }
+    prng::SiteStream site(prng::streamKey(key, 1));
+    key0[k] = site.k0;
+    key1[k] = site.k1;
+    streamSweeps = 0;
+  }
+
+  static constexpr int replicas() { return K; }
+  int size() const { return volume; }
+  int extent(int d) const { return L[d]; }
+
+  // Update counters of all replicas together; see XYLattice::updateStats.
+  const telemetry::UpdateStats& updateStats() const { return stats; }
+  telemetry::UpdateStats takeStats() { return std::exchange(stats, {}); }
+
+  // Threads used by Metropolis(), split over rows as in XYLattice.
+  void setThreads(int threads) {
+    threads = std::max(threads, 1);
+    pool = threads > 1 ? std::make_unique<ThreadPool>(threads) : nullptr;
+  }
+
+  int threads() const { return pool ? pool->size() : 1; }
+
+  // XYLattice::initializeData for every replica, each from its own generator.
+  void initializeData(bool aligned = false) {
+    for (int k = 0; k < K; k++) {
+      if (aligned) {
+        double angle = randPI(rng[k]);
+        for (int s = 0; s < volume; s++) spins[K * s + k] = angle;
+      } else {
+        for (int s = 0; s < volume; s++) spins[K * s + k] = randPI(rng[k]);
+      }
+    }
+    resync();
+  }
+
+  // Replica k in XYLattice's layout, and back (followed by resync()).
+  std::vector<double> replica(int k) const {
+    std::vector<double> result(volume);
+    for (int s = 0; s < volume; s++) result[s] = spins[K * s + k];
+    return result;
+  }
+
+  void setReplica(int k, const std::vector<double>& values) {
+    for (int s = 0; s < volume; s++) spins[K * s + k] = values[s];
+    resync();
+  }
+
+  // Recomputes the running totals of every replica from spins.
+  void resync() {
+    for (int k = 0; k < K; k++) {
+      mxSum[k] = mySum[k] = 0;
+      for (int s = 0; s < volume; s++) {
+        mxSum[k] += std::cos(spins[K * s + k]);
+        mySum[k] += std::sin(spins[K * s + k]);
+      }
+      energySum[k] = Energy(k) * volume;
+    }
+    sweepsSinceResync = 0;
+  }
+
+  void setResyncInterval(int sweeps) { resyncInterval = std::max(sweeps, 1); }
+
+  double currentEnergy(int k) const { return energySum[k] / volume; }
+  double currentMagnetization(int k) const { return std::hypot(mxSum[k], mySum[k]) / volume; }
+
+  double Magnetization(int k) const {
+    double sumX = 0, sumY = 0;
+    for (int s = 0; s < volume; s++) {
+      sumX += std::cos(spins[K * s + k]);
+      sumY += std::sin(spins[K * s + k]);
+    }
+    return std::hypot(sumX, sumY) / volume;
+  }
+
+  // XYLattice::Energy of replica k.
+  double Energy(int k) const {
+    double sum = 0;
+    for (int r = 0; r < rows(); r++) {
+      Row current = row(r);
+      for (int x = 0; x < L[0]; x++) {
+        int s = current.base + x;
+        sum -= std::cos(spins[K * s + k] - spins[K * (current.base + forward(0, x)) + k]);
+        for (int d = 1; d < D; d++) {
+          sum -= std::cos(spins[K * s + k] - spins[K * (s + current.offsets[2 * (d - 1)]) + k]);
+        }
+      }
+    }
+    return sum / volume;
+  }
+
+  // One checkerboard sweep of every replica; totals per row are summed in
+  // row order, as in XYLattice.
+  void Metropolis() {
+    if constexpr (telemetry::enabled) stats.attempts += static_cast<long>(K) * volume;
+    rowDeltas.assign(rows(), Delta{});
+    for (int color = 0; color < 2; color++) {
+      forRows([&](int begin, int end, int) {
+        for (int r = begin; r < end; r++) {
+          Row current = row(r);
+          metropolisRow(current, (current.parity + color) & 1, rowDeltas[r]);
+        }
+      });
+    }
+    for (const auto& d : rowDeltas) {
+      for (int k = 0; k < K; k++) {
+        energySum[k] += d.e[k];
+        mxSum[k] += d.mx[k];
+        mySum[k] += d.my[k];
+      }
+      if constexpr (telemetry::enabled) stats.accepted += d.accepted;
+    }
+    streamSweeps++;
+    countSweep();
+  }
+};
@@ -0,0 +1,310 @@
+#pragma once
+#include <highfive/highfive.hpp>
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <limits>
+#include <filesystem>
+#include <stdexcept>
+#include "Telemetry.hpp"
+
+// Incremental HDF5 output for the drivers. Observable tables are created up
+// front as chunked, NaN-filled datasets and every finished point is written
+// (and flushed) as soon as it completes, together with a Done flag, so a
+// crash loses at most the points in flight. Checkpoints keep the spins, model
+// state and partial sums of long-running points. All calls are serialized
+// by one mutex, since the HDF5 library itself is not thread-safe; with a
+// Telemetry attached, waiting for it counts as lock time and the calls as I/O.
+class ResultStore {
+public:
+  enum class Mode {
+    Fresh,      // refuse to touch an existing file
+    Overwrite,  // truncate an existing file
+    Resume,     // reopen, keep finished points and checkpoints
+  };
+
+  struct Checkpoint {
+    std::vector<double> spins;
+    std::string state;         // XYLattice::state()
+    std::vector<double> sums;  // driver-defined partial results
+    long step = 0;             // driver-defined progress
+  };
+
+private:
+  struct Table {
+    std::vector<size_t> dims;
+    std::vector<char> done;
+  };
+
+  HighFive::File file;
+  std::map<std::string, Table> tables;
+  std::mutex mutex;
+  Telemetry* telemetry = nullptr;
+
+  // Holds the mutex for the duration of one call.
+  class Access {
+    std::unique_lock<std::mutex> lock;
+    Telemetry::Timer io;
+
+    static std::unique_lock<std::mutex> acquire(ResultStore& store) {
+      Telemetry::Timer wait(store.telemetry, Telemetry::Lock);
+      return std::unique_lock(store.mutex);
+    }
+
+  public:
+    explicit Access(ResultStore& store) : lock(acquire(store)), io(store.telemetry, Telemetry::IO) {}
+  };
+
+  static HighFive::File::AccessMode openFlags(const std::string& path, Mode mode) {
+    bool exists = std::filesystem::exists(path);
+    if (mode == Mode::Fresh && exists) {
+      throw std::runtime_error(path + " exists; pass --resume to continue it or --overwrite to replace it");
+    }
+    if (mode == Mode::Resume && exists) return HighFive::File::ReadWrite;
+    return HighFive::File::ReadWrite | HighFive::File::Create | HighFive::File::Truncate;
+  }
+
+  // Unlike File::exist, does not fail when an intermediate group is missing.
+  bool exists(const std::string& path) {
+    std::string prefix;
+    size_t start = 1;
+    while (start <= path.size()) {
+      size_t end = path.find('/', start);
+      if (end == std::string::npos) end = path.size();
+      prefix += "/" + path.substr(start, end - start);
+      if (!file.exist(prefix)) return false;
+      start = end + 1;
+    }
+    return true;
+  }
+
+  size_t flatten(const Table& table, const std::vector<size_t>& index) const {
+    size_t flat = 0;
+    for (size_t d = 0; d < table.dims.size(); d++) flat = flat * table.dims[d] + index[d];
+    return flat;
+  }
+
+  static std::vector<size_t> ones(size_t n) { return std::vector<size_t>(n, 1); }
+
+  template <typename T>
+  HighFive::DataSet create(const std::string& path, const std::vector<size_t>& dims, T fill, int deflate = 0) {
+    if (exists(path)) return file.getDataSet(path);
+    std::vector<hsize_t> chunk(dims.size(), 1);
+    chunk.back() = dims.back();
+    HighFive::DataSetCreateProps props;
+    props.add(HighFive::Chunking(chunk));
+    if (deflate > 0) {
+      props.add(HighFive::Shuffle());
+      props.add(HighFive::Deflate(deflate));
+    }
+    auto dataset = file.createDataSet<T>(path, HighFive::DataSpace(dims), props);
+    std::vector<T> values(dataset.getElementCount(), fill);
+    dataset.write_raw(values.data());
+    return dataset;
+  }
+
+  template <typename T>
+  void replace(const std::string& path, const T& value) {
+    if (exists(path)) file.unlink(path);
+    file.createDataSet(path, value);
+  }
+
+public:
+  ResultStore(const std::string& path, Mode mode) : file(path, openFlags(path, mode)) {}
+
+  void setTelemetry(Telemetry* telemetry_) { telemetry = telemetry_; }
+
+  // Stores a fixed input such as /T. When resuming it must match what the
+  // file already holds, so a run is never continued with a different setup.
+  template <typename T>
+  void setInput(const std::string& path, const T& value) {
+    Access access(*this);
+    if (!exists(path)) {
+      file.createDataSet(path, value);
+    } else if (file.getDataSet(path).read<T>() != value) {
+      throw std::runtime_error(path + " differs from the data being resumed");
+    }
+  }
+
+  // Creates a chunked, NaN-filled dataset of the given shape; chunks span
+  // the last axis. Existing datasets are kept.
+  void prepareDataset(const std::string& path, const std::vector<size_t>& dims) {
+    Access access(*this);
+    create<double>(path, dims, std::numeric_limits<double>::quiet_NaN());
+    file.flush();
+  }
+
+  // Same, shuffled and deflate-compressed, for long per-sweep series along
+  // the last axis.
+  void prepareSeries(const std::string& path, const std::vector<size_t>& dims, int deflate = 4) {
+    Access access(*this);
+    create<double>(path, dims, std::numeric_limits<double>::quiet_NaN(), deflate);
+    file.flush();
+  }
+
+  // Creates group/<name> for every name plus the group/Done mask, all of
+  // the same shape. Existing tables are reopened with their mask.
+  void prepareTable(const std::string& group, const std::vector<size_t>& dims,
+                    const std::vector<std::string>& names) {
+    Access access(*this);
+    for (const auto& name : names) {
+      create<double>(group + "/" + name, dims, std::numeric_limits<double>::quiet_NaN());
+    }
+    auto mask = create<char>(group + "/Done", dims, 0);
+    Table table{dims, std::vector<char>(mask.getElementCount())};
+    mask.read_raw(table.done.data());
+    tables[group] = std::move(table);
+    file.flush();
+  }
+
+  bool done(const std::string& group, const std::vector<size_t>& index) {
+    Access access(*this);
+    const auto& table = tables.at(group);
+    return table.done[flatten(table, index)];
+  }
+
+  // Writes one finished point: values[i] goes to group/names[i] at index.
+  void store(const std::string& group, const std::vector<size_t>& index,
+             const std::vector<std::string>& names, const std::vector<double>& values) {
+    Access access(*this);
+    auto& table = tables.at(group);
+    for (size_t i = 0; i < names.size(); i++) {
+      file.getDataSet(group + "/" + names[i]).select(index, ones(index.size())).write_raw(&values[i]);
+    }
+    char flag = 1;
+    file.getDataSet(group + "/Done").select(index, ones(index.size())).write_raw(&flag);
+    table.done[flatten(table, index)] = 1;
+    file.flush();
+  }
+
+  // Same for a row of points along the last axis, starting at index.
+  void storeRow(const std::string& group, const std::vector<size_t>& index,
+                const std::vector<std::string>& names, const std::vector<std::vector<double>>& values) {
+    Access access(*this);
+    auto& table = tables.at(group);
+    auto count = ones(index.size());
+    count.back() = values[0].size();
+    for (size_t i = 0; i < names.size(); i++) {
+      file.getDataSet(group + "/" + names[i]).select(index, count).write_raw(values[i].data());
+    }
+    std::vector<char> flags(count.back(), 1);
+    file.getDataSet(group + "/Done").select(index, count).write_raw(flags.data());
+    size_t flat = flatten(table, index);
+    std::fill_n(table.done.begin() + flat, count.back(), 1);
+    file.flush();
+  }
+
+  // Writes values along the last axis of path starting at index, without
+  // marking anything done; for per-point data outside a table.
+  void writeRow(const std::string& path, const std::vector<size_t>& index, const std::vector<double>& values) {
+    Access access(*this);
+    auto count = ones(index.size());
+    count.back() = values.size();
+    file.getDataSet(path).select(index, count).write_raw(values.data());
+  }
+
+  template <typename T>
+  T read(const std::string& path) {
+    Access access(*this);
+    return file.getDataSet(path).read<T>();
+  }
+
+  // As read(), or nothing when the file has no such dataset.
+  template <typename T>
+  std::optional<T> tryRead(const std::string& path) {
+    Access access(*this);
+    if (!exists(path)) return std::nullopt;
+    return file.getDataSet(path).read<T>();
+  }
+
+  // Copies the points marked done in group of other (same names and shape)
+  // into the prepared table of this store, keeping points already done here.
+  // Returns the number of points added.
+  size_t merge(ResultStore& other, const std::string& group, const std::vector<std::string>& names) {
+    std::vector<char> theirs;
+    std::vector<std::vector<double>> values(names.size());
+    {
+      Access access(other);
+      if (!other.exists(group + "/Done")) return 0;
+      auto mask = other.file.getDataSet(group + "/Done");
+      theirs.resize(mask.getElementCount());
+      mask.read_raw(theirs.data());
+      for (size_t i = 0; i < names.size(); i++) {
+        auto dataset = other.file.getDataSet(group + "/" + names[i]);
+        values[i].resize(dataset.getElementCount());
+        dataset.read_raw(values[i].data());
+      }
+    }
+
+    Access access(*this);
+    auto& table = tables.at(group);
+    if (theirs.size() != table.done.size()) throw std::runtime_error(group + " differs in shape from the data being merged");
+    for (size_t i = 0; i < names.size(); i++) {
+      auto dataset = file.getDataSet(group + "/" + names[i]);
+      std::vector<double> mine(dataset.getElementCount());
+      dataset.read_raw(mine.data());
+      for (size_t k = 0; k < mine.size(); k++) {
+        if (theirs[k] && !table.done[k]) mine[k] = values[i][k];
+      }
+      dataset.write_raw(mine.data());
+    }
+    size_t added = 0;
+    for (size_t k = 0; k < theirs.size(); k++) {
+      if (theirs[k] && !table.done[k]) {
+        table.done[k] = 1;
+        added++;
+      }
+    }
+    file.getDataSet(group + "/Done").write_raw(table.done.data());
+    file.flush();
+    return added;
+  }
+
+  template <typename T>
+  void write(const std::string& path, const T& value) {
+    Access access(*this);
+    replace(path, value);
+    file.flush();
+  }
+
+  void saveCheckpoint(const std::string& key, const Checkpoint& checkpoint) {
+    Access access(*this);
+    const std::string base = "/checkpoints/" + key;
+    replace(base + "/spins", checkpoint.spins);
+    replace(base + "/state", checkpoint.state);
+    replace(base + "/sums", checkpoint.sums);
+    replace(base + "/step", checkpoint.step);
+    file.flush();
+  }
+
+  std::optional<Checkpoint> loadCheckpoint(const std::string& key) {
+    Access access(*this);
+    const std::string base = "/checkpoints/" + key;
+    if (!exists(base + "/step")) return std::nullopt;
+    Checkpoint checkpoint;
+    checkpoint.spins = file.getDataSet(base + "/spins").read<std::vector<double>>();
+    checkpoint.state = file.getDataSet(base + "/state").read<std::string>();
+    checkpoint.sums = file.getDataSet(base + "/sums").read<std::vector<double>>();
+    checkpoint.step = file.getDataSet(base + "/step").read<long>();
+    return checkpoint;
+  }
+
+  void dropCheckpoint(const std::string& key) {
+    Access access(*this);
+    if (exists("/checkpoints/" + key)) file.unlink("/checkpoints/" + key);
+    file.flush();
+  }
+};
+
+// --resume / --overwrite from the command line, Fresh otherwise.
+inline ResultStore::Mode storeMode(int argc, char** argv) {
+  auto mode = ResultStore::Mode::Fresh;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--resume") mode = ResultStore::Mode::Resume;
+    else if (arg == "--overwrite") mode = ResultStore::Mode::Overwrite;
+  }
+  return mode;
+}
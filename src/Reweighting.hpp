@@ -0,0 +1,475 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+// Ferrenberg-Swendsen multi-histogram reweighting. The energy and
+// magnetization series of a few runs at different temperatures are combined
+// into one estimate of the density of states, from which E, M, C and chi
+// follow at any temperature in (and a little beyond) the simulated range.
+// One run gives plain single-histogram reweighting. Samples are used
+// directly instead of being binned, and everything is done in log space,
+// since beta * E runs into the thousands on large lattices.
+//
+// Estimates are only as good as the overlap of neighbouring energy
+// histograms; the relative width of a histogram shrinks like 1/sqrt(volume),
+// so larger lattices need more closely spaced runs. gap() tells how well a
+// temperature is covered.
+class MultiHistogram {
+public:
+  using Observables = std::array<double, 4>;  // E, M, C, chi per site
+
+  struct Curve {
+    std::vector<Observables> value, error;  // per requested temperature
+  };
+
+  struct Peak {
+    double T = 0, height = 0;
+    double dT = 0, dHeight = 0;  // jackknife errors
+  };
+
+private:
+  struct Run {
+    double beta;
+    std::vector<double> e, m;  // per site, per sample
+    std::vector<int> blockSizes;  // samples in each jackknife block
+  };
+
+  // All samples of all runs back to back, for the inner loops. E is taken
+  // from the lowest energy of all samples, E0, which only shifts every f_k
+  // by beta_k E0 but keeps them small enough to be solved to high precision.
+  struct Samples {
+    double E0 = 0;
+    std::vector<double> E, e, m;   // total energy above E0, per-site e and m
+    std::vector<int> block;        // jackknife block within its run
+  };
+
+  // Free energies with one block left out (or none), and the log
+  // denominators of the samples under them, which is all estimate() needs.
+  struct Solution {
+    std::vector<double> f, logD;
+  };
+
+  // Across a gap of more than this many histogram widths (see gap()) two
+  // neighbouring runs share next to no samples. The equations then hardly
+  // tie their free energies together, and not at all once the samples are
+  // separated: the likelihood grows without bound as the difference goes to
+  // infinity, and the iteration creeps after it.
+  static constexpr double reach = 4;
+
+  std::vector<Run> runs;
+  int volume;
+  int blocks;
+  Samples samples;
+  std::vector<size_t> order;  // runs by increasing T
+  std::vector<bool> linked;   // order[j] and order[j + 1] within reach
+  double tolerance = 1e-10;
+  Solution full;               // of all data; empty until solved
+  std::vector<Solution> jack;  // per left-out block, solved on first use
+
+  // Block b holds samples [b * length, (b + 1) * length) of a run; the last
+  // one also takes the remainder.
+  int blockOf(const Run& run, size_t i) const {
+    const size_t length = std::max<size_t>(run.e.size() / blocks, 1);
+    return static_cast<int>(std::min<size_t>(i / length, blocks - 1));
+  }
+
+  static std::pair<double, double> moments(const Run& run) {
+    double mean = 0, var = 0;
+    for (double e : run.e) mean += e / run.e.size();
+    for (double e : run.e) var += (e - mean) * (e - mean) / run.e.size();
+    return {mean, var};
+  }
+
+  static double separation(const Run& a, const Run& b) {
+    auto [e0, var0] = moments(a);
+    auto [e1, var1] = moments(b);
+    return std::abs(e1 - e0) / std::sqrt((var0 + var1) / 2);
+  }
+
+  void flatten() {
+    samples = {};
+    samples.E0 = std::numeric_limits<double>::infinity();
+    for (const auto& run : runs) {
+      for (double e : run.e) samples.E0 = std::min(samples.E0, e * volume);
+    }
+    for (auto& run : runs) {
+      run.blockSizes.assign(blocks, 0);
+      for (size_t i = 0; i < run.e.size(); i++) {
+        const int b = blockOf(run, i);
+        samples.E.push_back(run.e[i] * volume - samples.E0);
+        samples.e.push_back(run.e[i]);
+        samples.m.push_back(run.m[i]);
+        samples.block.push_back(b);
+        run.blockSizes[b]++;
+      }
+    }
+
+    order.resize(runs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return runs[a].beta > runs[b].beta; });
+    linked.clear();
+    for (size_t j = 0; j + 1 < order.size(); j++) {
+      linked.push_back(separation(runs[order[j]], runs[order[j + 1]]) < reach);
+    }
+  }
+
+  // log n_l with jackknife block `skip` left out (skip < 0: all data).
+  std::vector<double> logCounts(int skip) const {
+    std::vector<double> logN(runs.size());
+    for (size_t l = 0; l < runs.size(); l++) {
+      size_t n = runs[l].e.size() - (skip >= 0 ? runs[l].blockSizes[skip] : 0);
+      logN[l] = std::log(static_cast<double>(n));
+    }
+    return logN;
+  }
+
+  // log of sum_l n_l exp(-beta_l E + f_l) for every included sample;
+  // excluded ones get +inf, i.e. zero weight.
+  std::vector<double> logDenominators(int skip, const std::vector<double>& fk) const {
+    const size_t R = runs.size();
+    auto logN = logCounts(skip);
+    std::vector<double> logD(samples.E.size(), std::numeric_limits<double>::infinity());
+    std::vector<double> terms(R);
+    for (size_t i = 0; i < samples.E.size(); i++) {
+      if (samples.block[i] == skip) continue;
+      double top = -std::numeric_limits<double>::infinity();
+      for (size_t l = 0; l < R; l++) {
+        terms[l] = logN[l] - runs[l].beta * samples.E[i] + fk[l];
+        top = std::max(top, terms[l]);
+      }
+      double sum = 0;
+      for (size_t l = 0; l < R; l++) sum += std::exp(terms[l] - top);
+      logD[i] = top + std::log(sum);
+    }
+    return logD;
+  }
+
+  // log S_k for S_k = sum_i w_ik over the included samples, with weights
+  // w_ik = exp(f_k - beta_k E_i - logD_i); f solves the equations when every
+  // S_k is 1. S_k of a distant run is easily exp(-1000), hence the sums are
+  // taken relative to their largest term.
+  std::vector<double> logSums(const std::vector<double>& fk, const std::vector<double>& logD) const {
+    const size_t R = runs.size();
+    std::vector<double> top(R, -std::numeric_limits<double>::infinity()), sum(R, 0.0);
+    for (size_t i = 0; i < logD.size(); i++) {
+      if (std::isinf(logD[i])) continue;
+      for (size_t k = 0; k < R; k++) top[k] = std::max(top[k], -runs[k].beta * samples.E[i] - logD[i]);
+    }
+    for (size_t i = 0; i < logD.size(); i++) {
+      if (std::isinf(logD[i])) continue;
+      for (size_t k = 0; k < R; k++) sum[k] += std::exp(-runs[k].beta * samples.E[i] - logD[i] - top[k]);
+    }
+    std::vector<double> logS(R);
+    for (size_t k = 0; k < R; k++) logS[k] = fk[k] + top[k] + std::log(sum[k]);
+    return logS;
+  }
+
+  // One step of the self-consistent equations, f_k - log S_k, shifted so
+  // that f_0 = 0.
+  std::vector<double> update(const std::vector<double>& fk, const std::vector<double>& logD) const {
+    auto next = logSums(fk, logD);
+    for (size_t k = 0; k < next.size(); k++) next[k] = fk[k] - next[k];
+    for (size_t k = next.size(); k-- > 0;) next[k] -= next[0];
+    return next;
+  }
+
+  // Largest change update() makes to fk, relative to 1 + |f_k|.
+  static double distance(const std::vector<double>& fk, const std::vector<double>& next) {
+    double change = 0;
+    for (size_t k = 0; k < fk.size(); k++) change = std::max(change, std::abs(next[k] - fk[k]) / (1 + std::abs(fk[k])));
+    return change;
+  }
+
+  // Solves A x = b in place by Gaussian elimination with partial pivoting;
+  // false if A is singular to working precision.
+  static bool linearSolve(std::vector<double>& A, std::vector<double>& b) {
+    const size_t n = b.size();
+    double scale = 0;
+    for (double a : A) scale = std::max(scale, std::abs(a));
+    for (size_t c = 0; c < n; c++) {
+      size_t pivot = c;
+      for (size_t k = c + 1; k < n; k++) {
+        if (std::abs(A[k * n + c]) > std::abs(A[pivot * n + c])) pivot = k;
+      }
+      if (!(std::abs(A[pivot * n + c]) > 1e-14 * scale)) return false;
+      for (size_t l = 0; l < n; l++) std::swap(A[c * n + l], A[pivot * n + l]);
+      std::swap(b[c], b[pivot]);
+      for (size_t k = c + 1; k < n; k++) {
+        double factor = A[k * n + c] / A[c * n + c];
+        for (size_t l = c; l < n; l++) A[k * n + l] -= factor * A[c * n + l];
+        b[k] -= factor * b[c];
+      }
+    }
+    for (size_t c = n; c-- > 0;) {
+      for (size_t l = c + 1; l < n; l++) b[c] -= A[c * n + l] * b[l];
+      b[c] /= A[c * n + c];
+    }
+    return true;
+  }
+
+  // Shifts the runs beyond every unlinked gap together, so that the
+  // difference of f across the gap is the one of `anchor`.
+  void tie(std::vector<double>& fk, const std::vector<double>& anchor) const {
+    double shift = 0;
+    for (size_t j = 0; j < order.size(); j++) {
+      const size_t k = order[j];
+      if (j > 0 && !linked[j - 1]) {
+        const size_t p = order[j - 1];
+        shift = fk[p] + anchor[k] - anchor[p] - fk[k];
+      }
+      fk[k] += shift;
+    }
+    for (size_t k = fk.size(); k-- > 0;) fk[k] -= fk[0];
+  }
+
+  // Solves for f with jackknife block `skip` left out of every run (skip < 0:
+  // all data), started from fk. Across unlinked gaps f is held at the chain()
+  // estimate, so the solve is that of the linked groups of runs. The plain
+  // iteration f -> update(f) needs a number of steps that grows with the
+  // square of the number of closely spaced runs, so it is accelerated by
+  // DIIS: the next f is the combination of the last few updates whose
+  // residuals update(f) - f cancel best. When that makes things worse, the
+  // history is dropped and the plain step taken.
+  Solution solve(int skip, std::vector<double> fk, int maxIterations = 10000) const {
+    const size_t R = runs.size();
+    const size_t history = 8;
+    const auto anchor = chain(skip);
+    tie(fk, anchor);
+    std::vector<std::vector<double>> mapped, residuals;
+    double best = std::numeric_limits<double>::infinity();
+    Solution result;
+    for (int it = 0; it < maxIterations; it++) {
+      result.logD = logDenominators(skip, fk);
+      auto next = update(fk, result.logD);
+      tie(next, anchor);
+      const double change = distance(fk, next);
+      if (change < tolerance) break;
+
+      std::vector<double> r(R);
+      for (size_t k = 0; k < R; k++) r[k] = next[k] - fk[k];
+      if (!(change < 2 * best)) {
+        mapped.clear();
+        residuals.clear();
+      }
+      best = std::min(best, change);
+      mapped.push_back(std::move(next));
+      residuals.push_back(std::move(r));
+      if (mapped.size() > history) {
+        mapped.erase(mapped.begin());
+        residuals.erase(residuals.begin());
+      }
+
+      // Minimize |sum_j c_j r_j| subject to sum_j c_j = 1. Close to the
+      // solution the residuals become nearly parallel; the oldest are then
+      // dropped until the system is regular again.
+      fk = mapped.back();
+      while (mapped.size() > 1) {
+        const size_t m = mapped.size();
+        // The Gram matrix is scaled to order 1, which leaves c unchanged.
+        std::vector<double> A((m + 1) * (m + 1), 0.0), c(m + 1, 0.0);
+        double scale = 0;
+        for (const auto& r : residuals) scale = std::max(scale, std::inner_product(r.begin(), r.end(), r.begin(), 0.0));
+        for (size_t i = 0; i < m; i++) {
+          for (size_t j = 0; j < m; j++) {
+            A[i * (m + 1) + j] = std::inner_product(residuals[i].begin(), residuals[i].end(), residuals[j].begin(), 0.0) / scale;
+          }
+          A[i * (m + 1) + m] = A[m * (m + 1) + i] = 1;
+        }
+        c[m] = 1;
+        if (linearSolve(A, c)) {
+          std::fill(fk.begin(), fk.end(), 0.0);
+          for (size_t j = 0; j < m; j++) {
+            for (size_t k = 0; k < R; k++) fk[k] += c[j] * mapped[j][k];
+          }
+          break;
+        }
+        mapped.erase(mapped.begin());
+        residuals.erase(residuals.begin());
+      }
+    }
+    result.f = std::move(fk);
+    return result;
+  }
+
+  // Going up in T, each f from the one before by single-histogram
+  // reweighting of the run before alone, log Z_{k+1} / Z_k =
+  // log <exp(-(beta_{k+1} - beta_k) E)>_k, with block `skip` left out. The
+  // starting point of solve() and its only handle on unlinked gaps, where it
+  // rests on the tail of one histogram.
+  std::vector<double> chain(int skip) const {
+    const size_t R = runs.size();
+    std::vector<double> fk(R, 0.0);
+    for (size_t j = 0; j + 1 < R; j++) {
+      const Run& run = runs[order[j]];
+      const double dBeta = runs[order[j + 1]].beta - run.beta;
+      const double n = run.e.size() - (skip >= 0 ? run.blockSizes[skip] : 0);
+      double top = -std::numeric_limits<double>::infinity(), sum = 0;
+      for (size_t i = 0; i < run.e.size(); i++) {
+        if (blockOf(run, i) != skip) top = std::max(top, -dBeta * (run.e[i] * volume - samples.E0));
+      }
+      for (size_t i = 0; i < run.e.size(); i++) {
+        if (blockOf(run, i) != skip) sum += std::exp(-dBeta * (run.e[i] * volume - samples.E0) - top);
+      }
+      fk[order[j + 1]] = fk[order[j]] - top - std::log(sum / n);
+    }
+    for (size_t k = R; k-- > 0;) fk[k] -= fk[0];
+    return fk;
+  }
+
+  const Solution& solved() {
+    if (full.f.empty()) solve();
+    return full;
+  }
+
+  // The solution with block b left out, warm-started from the full data
+  // and kept for later calls.
+  const Solution& leaveOut(int b) {
+    solved();
+    if (jack.empty()) jack.resize(blocks);
+    if (jack[b].f.empty()) jack[b] = solve(b, full.f);
+    return jack[b];
+  }
+
+  Observables estimate(double T, const Solution& solution) const {
+    const double beta = 1.0 / T;
+    const auto& logD = solution.logD;
+    double top = -std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < logD.size(); i++) top = std::max(top, -beta * samples.E[i] - logD[i]);
+    double z = 0, se = 0, sm = 0, se2 = 0, sm2 = 0;
+    for (size_t i = 0; i < logD.size(); i++) {
+      double w = std::exp(-beta * samples.E[i] - logD[i] - top);
+      z += w;
+      se += w * samples.e[i];
+      sm += w * samples.m[i];
+      se2 += w * samples.e[i] * samples.e[i];
+      sm2 += w * samples.m[i] * samples.m[i];
+    }
+    double _e = se / z, _m = sm / z;
+    return {_e, _m, (se2 / z - _e * _e) * volume / (T * T), (sm2 / z - _m * _m) * volume / T};
+  }
+
+  // Golden-section search for the maximum of observable k on [a, b].
+  double argmax(int k, double a, double b, const Solution& solution) const {
+    const double g = (std::sqrt(5.0) - 1) / 2;
+    double c = b - g * (b - a), d = a + g * (b - a);
+    double fc = estimate(c, solution)[k], fd = estimate(d, solution)[k];
+    while (b - a > 1e-6 * (std::abs(a) + std::abs(b))) {
+      if (fc > fd) {
+        b = d; d = c; fd = fc;
+        c = b - g * (b - a);
+        fc = estimate(c, solution)[k];
+      } else {
+        a = c; c = d; fc = fd;
+        d = a + g * (b - a);
+        fd = estimate(d, solution)[k];
+      }
+    }
+    return (a + b) / 2;
+  }
+
+public:
+  // blocks: jackknife blocks per run.
+  explicit MultiHistogram(int volume_, int blocks_ = 16) : volume(volume_), blocks(blocks_) {}
+
+  // Adds the per-site energy and magnetization series of a run at T.
+  void addRun(double T, std::vector<double> e, std::vector<double> m) {
+    runs.push_back({1.0 / T, std::move(e), std::move(m), {}});
+    full = {};
+    jack.clear();
+    flatten();
+  }
+
+  int size() const { return static_cast<int>(runs.size()); }
+
+  // Solves for the free energies to the given change per step, relative to
+  // 1 + |f_k|; the jackknife solutions use the same tolerance.
+  void solve(double tolerance_ = 1e-10, int maxIterations = 10000) {
+    tolerance = tolerance_;
+    full = solve(-1, chain(-1), maxIterations);
+    jack.clear();
+  }
+
+  const std::vector<double>& freeEnergies() const { return full.f; }
+
+  Observables at(double T) { return estimate(T, solved()); }
+
+  // How far apart the mean energies of the two runs around T are, in widths
+  // of their energy histograms: 0 at a simulated T, infinity outside the
+  // simulated range. Beyond about 2 the histograms hardly overlap, and the
+  // estimate at T mostly interpolates between the runs, by more than its
+  // jackknife error tells; beyond `reach` even the free energies across the
+  // gap are only a single-histogram estimate.
+  double gap(double T) const {
+    const Run* below = nullptr;
+    const Run* above = nullptr;
+    for (const auto& run : runs) {
+      if (1 / run.beta <= T && (!below || run.beta < below->beta)) below = &run;
+      if (1 / run.beta >= T && (!above || run.beta > above->beta)) above = &run;
+    }
+    if (!below || !above) return std::numeric_limits<double>::infinity();
+    if (below == above) return 0;
+    return separation(*below, *above);
+  }
+
+  // E, M, C and chi on the given temperatures, with jackknife errors from
+  // leaving one block out of every run at a time.
+  Curve reweight(const std::vector<double>& T) {
+    Curve curve{std::vector<Observables>(T.size()), std::vector<Observables>(T.size())};
+    for (size_t t = 0; t < T.size(); t++) curve.value[t] = estimate(T[t], solved());
+
+    std::vector<std::vector<Observables>> values(blocks, std::vector<Observables>(T.size()));
+    for (int b = 0; b < blocks; b++) {
+      const auto& solution = leaveOut(b);
+      for (size_t t = 0; t < T.size(); t++) values[b][t] = estimate(T[t], solution);
+    }
+    for (size_t t = 0; t < T.size(); t++) {
+      for (int k = 0; k < 4; k++) {
+        double mean = 0, var = 0;
+        for (int b = 0; b < blocks; b++) mean += values[b][t][k] / blocks;
+        for (int b = 0; b < blocks; b++) var += (values[b][t][k] - mean) * (values[b][t][k] - mean);
+        curve.error[t][k] = std::sqrt(var * (blocks - 1) / blocks);
+      }
+    }
+    return curve;
+  }
+
+  // Location and height of the maximum of observable k (2 = C, 3 = chi)
+  // inside [Tmin, Tmax]: the largest point of a coarse scan, refined by
+  // golden-section search, with jackknife errors. A peak at Tmin or Tmax is
+  // not one: the maximum lies beyond, or the curve is too flat to tell.
+  Peak peak(int k, double Tmin, double Tmax, int scan = 64) {
+    auto locate = [&](const Solution& solution) {
+      double step = (Tmax - Tmin) / (scan - 1);
+      int best = 0;
+      double height = -std::numeric_limits<double>::infinity();
+      for (int i = 0; i < scan; i++) {
+        double h = estimate(Tmin + i * step, solution)[k];
+        if (h > height) { height = h; best = i; }
+      }
+      double a = std::max(Tmin, Tmin + (best - 1) * step), b = std::min(Tmax, Tmin + (best + 1) * step);
+      double T = argmax(k, a, b, solution);
+      return std::pair{T, estimate(T, solution)[k]};
+    };
+
+    Peak result;
+    std::tie(result.T, result.height) = locate(solved());
+    std::vector<std::pair<double, double>> values(blocks);
+    double meanT = 0, meanH = 0;
+    for (int b = 0; b < blocks; b++) {
+      values[b] = locate(leaveOut(b));
+      meanT += values[b].first / blocks;
+      meanH += values[b].second / blocks;
+    }
+    for (int b = 0; b < blocks; b++) {
+      result.dT += (values[b].first - meanT) * (values[b].first - meanT);
+      result.dHeight += (values[b].second - meanH) * (values[b].second - meanH);
+    }
+    result.dT = std::sqrt(result.dT * (blocks - 1) / blocks);
+    result.dHeight = std::sqrt(result.dHeight * (blocks - 1) / blocks);
+    return result;
+  }
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "ResultStore.hpp"
+
+// Background writer for per-sweep time series. push() only moves the rows
+// into a queue; a dedicated thread compresses and writes them to the store,
+// so sampling never waits on HDF5. The queue is unbounded: it holds whatever
+// the writer has not caught up with yet. Destruction drains the queue.
+class SeriesWriter {
+public:
+  struct Row {
+    std::string path;
+    std::vector<size_t> index;
+    std::vector<double> values;
+  };
+
+private:
+  struct Job {
+    std::vector<Row> rows;
+    std::function<void()> then;
+  };
+
+  ResultStore& store;
+  std::deque<Job> jobs;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::thread worker;
+
+  void loop() {
+    while (true) {
+      Job job;
+      {
+        std::unique_lock lock(mutex);
+        wake.wait(lock, [&] { return stopping || !jobs.empty(); });
+        if (jobs.empty()) return;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      for (const auto& row : job.rows) store.writeRow(row.path, row.index, row.values);
+      if (job.then) job.then();
+    }
+  }
+
+public:
+  explicit SeriesWriter(ResultStore& store_) : store(store_), worker([this] { loop(); }) {}
+
+  SeriesWriter(const SeriesWriter&) = delete;
+  SeriesWriter& operator=(const SeriesWriter&) = delete;
+
+  ~SeriesWriter() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+  }
+
+  // Queues rows for writing. then() runs on the writer thread once they are
+  // written, e.g. to store the point's averages and mark it done only after
+  // its series is on disk.
+  void push(std::vector<Row> rows, std::function<void()> then = {}) {
+    {
+      std::lock_guard lock(mutex);
+      jobs.push_back({std::move(rows), std::move(then)});
+    }
+    wake.notify_one();
+  }
+};
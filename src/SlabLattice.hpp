@@ -0,0 +1,236 @@
+#pragma once
+#include <mpi.h>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <stdexcept>
+#include "Random.hpp"
+
+// XY model on a periodic D-dimensional hypercubic lattice distributed over
+// the ranks of an MPI communicator, for lattices beyond the memory of one
+// process. The lattice is cut into slabs along the last axis; every rank
+// keeps its planes plus a ghost copy of the plane on either side.
+//
+// Metropolis is the checkerboard sweep of XYLattice. Each half-sweep posts
+// the exchange of the two boundary planes, updates the interior planes while
+// the messages are in flight, and does the boundary planes once the ghosts
+// have arrived. Random numbers come from the same per-site stream as
+// XYLattice's, so for equal (seed, stream) and the same starting spins the
+// sweeps are those of an XYLattice with setVectorized(false), for any number
+// of ranks: bit for bit with -ffp-contract=off, otherwise up to where the
+// compiler fuses multiply-adds.
+//
+// Observables are reduced over all ranks, so every rank has to call them.
+template <int D>
+class SlabLattice {
+  static_assert(D >= 2 && D <= 4, "SlabLattice supports 2, 3 and 4 dimensions");
+
+private:
+  MPI_Comm comm;
+  int rank = 0, ranks = 1, below = 0, above = 0;
+
+  std::array<int, D> L;
+  int volume = 1;
+  int plane = 1;    // sites per plane
+  int planes = 0;   // local planes
+  int offset = 0;   // global index of the first local plane
+
+  // In-plane stencil (+/- along axes 0 .. D-2, as XYLattice orders it) and
+  // the colour of every in-plane position.
+  std::vector<std::array<int, 2 * (D - 1)>> stencil;
+  std::vector<char> parity;
+
+  prng::SiteStream siteStream, initStream;
+  uint64_t streamSweeps = 0;
+
+  // Local shares of the global running totals.
+  double energySum = 0, mxSum = 0, mySum = 0;
+  int resyncInterval = 1000;
+  int sweepsSinceResync = 0;
+
+  // Local plane z (-1 and planes are the ghosts), in-plane position p.
+  int local(int z, int p) const { return (z + 1) * plane + p; }
+  uint32_t global(int z, int p) const { return static_cast<uint32_t>((offset + z) * plane + p); }
+
+  void prepareStencil() {
+    stencil.resize(plane);
+    parity.resize(plane);
+    for (int p = 0; p < plane; p++) {
+      int sum = 0, stride = 1;
+      for (int d = 0, rest = p; d < D - 1; d++) {
+        int c = rest % L[d];
+        rest /= L[d];
+        sum += c;
+        int up = c + 1 == L[d] ? 0 : c + 1, down = c == 0 ? L[d] - 1 : c - 1;
+        stencil[p][2 * d] = p + (up - c) * stride;
+        stencil[p][2 * d + 1] = p + (down - c) * stride;
+        stride *= L[d];
+      }
+      parity[p] = sum & 1;
+    }
+  }
+
+  // Posts the boundary planes to the neighbouring ranks and the receives for
+  // the ghosts; complete with MPI_Waitall.
+  void startExchange(MPI_Request requests[4]) {
+    MPI_Irecv(&spins[local(-1, 0)], plane, MPI_DOUBLE, below, 0, comm, &requests[0]);
+    MPI_Irecv(&spins[local(planes, 0)], plane, MPI_DOUBLE, above, 1, comm, &requests[1]);
+    MPI_Isend(&spins[local(planes - 1, 0)], plane, MPI_DOUBLE, above, 0, comm, &requests[2]);
+    MPI_Isend(&spins[local(0, 0)], plane, MPI_DOUBLE, below, 1, comm, &requests[3]);
+  }
+
+  void exchange() {
+    MPI_Request requests[4];
+    startExchange(requests);
+    MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+  }
+
+  // The same arithmetic as XYLattice::metropolisStep, neighbours in the same
+  // order, so that the results agree exactly.
+  void metropolisPlane(int z, int color, double& de, double& dmx, double& dmy) {
+    for (int q = 0; q < plane; q += L[0]) {  // in-plane rows
+      for (int p = q + ((parity[q] + offset + z + color) & 1); p < q + L[0]; p += 2) {
+        int s = local(z, p);
+        double delta, u;
+        siteStream.uniforms(streamSweeps, global(z, p), 0, delta, u);
+        delta *= 2 * M_PI;
+
+        std::array<int, 2 * D> nb;
+        for (int k = 0; k < 2 * (D - 1); k++) nb[k] = local(z, stencil[p][k]);
+        nb[2 * D - 2] = s + plane;
+        nb[2 * D - 1] = s - plane;
+
+        double energy_now = 0, energy_after = 0;
+        for (int n : nb) {
+          energy_now -= std::cos(spins[s] - spins[n]);
+          energy_after -= std::cos(spins[s] + delta - spins[n]);
+        }
+        if (energy_after < energy_now || u < std::exp(-(energy_after - energy_now) / T)) {
+          double old = spins[s];
+          spins[s] = std::fmod(old + delta + 2 * M_PI, 2 * M_PI);
+          de += energy_after - energy_now;
+          dmx += std::cos(spins[s]) - std::cos(old);
+          dmy += std::sin(spins[s]) - std::sin(old);
+        }
+      }
+    }
+  }
+
+  void reduce(double local[], double global[], int n) const {
+    MPI_Allreduce(local, global, n, MPI_DOUBLE, MPI_SUM, comm);
+  }
+
+public:
+  // Local planes with one ghost plane before and after them.
+  std::vector<double> spins;
+  float T = 1.0;
+
+  template <std::integral... Ns>
+    requires (sizeof...(Ns) == D)
+  SlabLattice(MPI_Comm comm_, Ns... n) : comm(comm_), L{static_cast<int>(n)...} {
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+    below = (rank + ranks - 1) % ranks;
+    above = (rank + 1) % ranks;
+    for (int d = 0; d < D; d++) {
+      if (L[d] % 2) throw std::invalid_argument("SlabLattice needs even extents for the checkerboard");
+      volume *= L[d];
+    }
+    if (L[D - 1] % ranks) throw std::invalid_argument("the last extent must be a multiple of the number of ranks");
+    plane = volume / L[D - 1];
+    planes = L[D - 1] / ranks;
+    offset = rank * planes;
+    spins.assign((planes + 2) * plane, 0.0);
+    prepareStencil();
+    seed(0);
+  }
+
+  // As XYLattice::seed; every rank must pass the same values.
+  void seed(uint64_t seed, uint64_t stream = 0) {
+    uint64_t key = prng::streamKey(seed, stream);
+    siteStream = prng::SiteStream(prng::streamKey(key, 1));
+    initStream = prng::SiteStream(prng::streamKey(key, 2));
+    streamSweeps = 0;
+  }
+
+  int size() const { return volume; }
+  int localPlanes() const { return planes; }
+  int firstPlane() const { return offset; }
+
+  // Aligned: one common random angle; otherwise an independent angle per
+  // site, drawn per global site so that it does not depend on the ranks.
+  void initializeData(bool aligned = false) {
+    double a, b;
+    initStream.uniforms(0, 0, 0, a, b);
+    for (int z = 0; z < planes; z++) {
+      for (int p = 0; p < plane; p++) {
+        if (!aligned) initStream.uniforms(0, global(z, p), 1, a, b);
+        spins[local(z, p)] = 2 * M_PI * a;
+      }
+    }
+    resync();
+  }
+
+  // Recomputes the running totals from the spins (collective).
+  void resync() {
+    exchange();
+    energySum = mxSum = mySum = 0;
+    for (int z = 0; z < planes; z++) {
+      for (int p = 0; p < plane; p++) {
+        int s = local(z, p);
+        mxSum += std::cos(spins[s]);
+        mySum += std::sin(spins[s]);
+        for (int d = 0; d < D - 1; d++) energySum -= std::cos(spins[s] - spins[local(z, stencil[p][2 * d])]);
+        energySum -= std::cos(spins[s] - spins[s + plane]);
+      }
+    }
+    sweepsSinceResync = 0;
+  }
+
+  // One checkerboard Metropolis sweep (collective).
+  void Metropolis() {
+    double delta[3] = {0, 0, 0};
+    for (int color = 0; color < 2; color++) {
+      MPI_Request requests[4];
+      startExchange(requests);
+      for (int z = 1; z < planes - 1; z++) metropolisPlane(z, color, delta[0], delta[1], delta[2]);
+      MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+      metropolisPlane(0, color, delta[0], delta[1], delta[2]);
+      if (planes > 1) metropolisPlane(planes - 1, color, delta[0], delta[1], delta[2]);
+    }
+    energySum += delta[0];
+    mxSum += delta[1];
+    mySum += delta[2];
+    streamSweeps++;
+    if (++sweepsSinceResync >= resyncInterval) resync();
+  }
+
+  // O(1) per rank plus one reduction; per site like XYLattice's (collective).
+  double currentEnergy() const {
+    double local[1] = {energySum}, total[1];
+    reduce(local, total, 1);
+    return total[0] / volume;
+  }
+
+  double currentMagnetization() const {
+    double local[2] = {mxSum, mySum}, total[2];
+    reduce(local, total, 2);
+    return std::hypot(total[0], total[1]) / volume;
+  }
+
+  // Energy and magnetization per site in one reduction (collective).
+  std::array<double, 2> current() const {
+    double local[3] = {energySum, mxSum, mySum}, total[3];
+    reduce(local, total, 3);
+    return {total[0] / volume, std::hypot(total[1], total[2]) / volume};
+  }
+
+  // The whole lattice, in XYLattice's order, on rank 0; empty elsewhere
+  // (collective).
+  std::vector<double> gather() const {
+    std::vector<double> all(rank == 0 ? volume : 0);
+    MPI_Gather(&spins[local(0, 0)], planes * plane, MPI_DOUBLE, all.data(), planes * plane, MPI_DOUBLE, 0, comm);
+    return all;
+  }
+};
@@ -0,0 +1,242 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <string>
+#include <span>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <concepts>
+#include <stdexcept>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Append-only archive of spin configurations of one lattice shape, for
+// vortex analysis and warm starts. Angles are quantized to 16 bits (2 pi /
+// 65536, at most 5e-5 rad off), a quarter of the doubles in spins. A file
+// is a 64-byte header (magic, extents) followed by records of equal size:
+//
+//   double T, uint64 stream, uint64 sweep, uint64 reserved, uint16 level[volume]
+//
+// padded to 8 bytes. Records are only ever appended, so a crash can at most
+// leave a partial record at the end, which readers ignore and the next
+// writer cuts off. As all records have the same size, record i sits at a
+// fixed offset and SnapshotReader reaches it through the mapping without
+// reading the rest of the file.
+namespace snapshot {
+
+constexpr char magic[8] = {'X', 'Y', 'S', 'N', 'A', 'P', '0', '1'};
+constexpr double step = 2 * M_PI / 65536;
+
+struct Header {
+  char magic[8];
+  uint32_t dimension = 0;
+  uint32_t bits = 16;
+  std::array<uint32_t, 4> extents{};
+  uint64_t volume = 0;
+  uint64_t reserved[3] = {};
+};
+static_assert(sizeof(Header) == 64);
+
+struct Record {
+  double T = 0;
+  uint64_t stream = 0;  // driver-defined, e.g. the walk
+  uint64_t sweep = 0;   // driver-defined, e.g. the sweep within the point
+  uint64_t reserved = 0;
+};
+static_assert(sizeof(Record) == 32);
+
+inline size_t recordSize(uint64_t volume) {
+  return (sizeof(Record) + volume * sizeof(uint16_t) + 7) / 8 * 8;
+}
+
+inline uint16_t quantize(double theta) {
+  double turns = theta / (2 * M_PI);
+  turns -= std::floor(turns);
+  return static_cast<uint16_t>(static_cast<uint32_t>(turns * 65536) & 0xffff);
+}
+
+// The centre of the level's interval, in [0, 2 pi).
+inline double angle(uint16_t level) { return (level + 0.5) * step; }
+
+template <std::integral... Ns>
+Header header(Ns... n) {
+  static_assert(sizeof...(Ns) >= 1 && sizeof...(Ns) <= 4, "snapshots hold lattices of 1 to 4 dimensions");
+  Header h;
+  std::memcpy(h.magic, magic, sizeof(magic));
+  h.dimension = sizeof...(Ns);
+  h.extents = {static_cast<uint32_t>(n)...};
+  h.volume = (static_cast<uint64_t>(n) * ...);
+  return h;
+}
+
+inline bool sameShape(const Header& a, const Header& b) {
+  return std::memcmp(a.magic, b.magic, sizeof(magic)) == 0 && a.dimension == b.dimension && a.bits == b.bits &&
+         a.extents == b.extents && a.volume == b.volume;
+}
+
+}  // namespace snapshot
+
+// Appends configurations of lattices of extents n to a snapshot file,
+// creating it (and its directory) if needed. An existing file must hold the
+// same shape.
+class SnapshotWriter {
+  int fd = -1;
+  snapshot::Header shape;
+  std::vector<unsigned char> buffer;
+
+  void writeAll(const void* data, size_t size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    while (size > 0) {
+      ssize_t n = ::write(fd, bytes, size);
+      if (n < 0) throw std::runtime_error("SnapshotWriter: write failed");
+      bytes += n;
+      size -= n;
+    }
+  }
+
+public:
+  template <std::integral... Ns>
+  explicit SnapshotWriter(const std::string& path, Ns... n) : shape(snapshot::header(n...)) {
+    std::filesystem::path file(path);
+    if (file.has_parent_path()) std::filesystem::create_directories(file.parent_path());
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) throw std::runtime_error("SnapshotWriter: cannot open " + path);
+
+    struct stat info;
+    ::fstat(fd, &info);
+    if (info.st_size == 0) {
+      writeAll(&shape, sizeof(shape));
+    } else {
+      snapshot::Header existing;
+      if (info.st_size < static_cast<off_t>(sizeof(existing)) ||
+          ::pread(fd, &existing, sizeof(existing), 0) != sizeof(existing) || !snapshot::sameShape(existing, shape)) {
+        ::close(fd);
+        throw std::runtime_error("SnapshotWriter: " + path + " holds a different lattice shape");
+      }
+      // Cut off a partial record left by a crash.
+      size_t records = (info.st_size - sizeof(shape)) / snapshot::recordSize(shape.volume);
+      if (::ftruncate(fd, sizeof(shape) + records * snapshot::recordSize(shape.volume)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("SnapshotWriter: cannot truncate " + path);
+      }
+    }
+    ::lseek(fd, 0, SEEK_END);
+    buffer.resize(snapshot::recordSize(shape.volume));
+  }
+
+  SnapshotWriter(const SnapshotWriter&) = delete;
+  SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+  ~SnapshotWriter() { if (fd >= 0) ::close(fd); }
+
+  // Quantizes xy.spins and appends them as one record.
+  template <typename Lattice>
+  void append(const Lattice& xy, double T, uint64_t stream = 0, uint64_t sweep = 0) {
+    if (static_cast<uint64_t>(xy.size()) != shape.volume) throw std::invalid_argument("SnapshotWriter: lattice size does not match");
+    snapshot::Record record{T, stream, sweep, 0};
+    std::memcpy(buffer.data(), &record, sizeof(record));
+    auto levels = reinterpret_cast<uint16_t*>(buffer.data() + sizeof(record));
+    for (uint64_t s = 0; s < shape.volume; s++) levels[s] = snapshot::quantize(xy.spins[s]);
+    writeAll(buffer.data(), buffer.size());
+  }
+};
+
+// Read-only view of a snapshot file, mapped into memory: records are read
+// in place, and only the pages of those that are used get loaded. Records
+// appended after opening are not seen.
+class SnapshotReader {
+  int fd = -1;
+  const unsigned char* data = nullptr;
+  size_t bytes = 0;
+  snapshot::Header shape;
+  size_t records = 0;
+
+  const unsigned char* at(size_t i) const {
+    if (i >= records) throw std::out_of_range("SnapshotReader: no record " + std::to_string(i));
+    return data + sizeof(shape) + i * snapshot::recordSize(shape.volume);
+  }
+
+public:
+  explicit SnapshotReader(const std::string& path) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("SnapshotReader: cannot open " + path);
+    struct stat info;
+    ::fstat(fd, &info);
+    bytes = info.st_size;
+    if (bytes < sizeof(shape)) {
+      ::close(fd);
+      throw std::runtime_error("SnapshotReader: " + path + " is not a snapshot file");
+    }
+    void* mapped = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("SnapshotReader: cannot map " + path);
+    }
+    data = static_cast<const unsigned char*>(mapped);
+    std::memcpy(&shape, data, sizeof(shape));
+    if (std::memcmp(shape.magic, snapshot::magic, sizeof(snapshot::magic)) != 0 || shape.bits != 16) {
+      ::munmap(mapped, bytes);
+      ::close(fd);
+      throw std::runtime_error("SnapshotReader: " + path + " is not a snapshot file");
+    }
+    records = (bytes - sizeof(shape)) / snapshot::recordSize(shape.volume);
+  }
+
+  SnapshotReader(const SnapshotReader&) = delete;
+  SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+  ~SnapshotReader() {
+    if (data) ::munmap(const_cast<unsigned char*>(data), bytes);
+    if (fd >= 0) ::close(fd);
+  }
+
+  size_t size() const { return records; }
+  int dimension() const { return shape.dimension; }
+  int extent(int d) const { return shape.extents[d]; }
+  uint64_t volume() const { return shape.volume; }
+
+  snapshot::Record record(size_t i) const {
+    snapshot::Record r;
+    std::memcpy(&r, at(i), sizeof(r));
+    return r;
+  }
+
+  // The quantized angles of record i, in the lattice's site order; angle
+  // (level + 0.5) * 2 pi / 65536. Valid as long as the reader.
+  std::span<const uint16_t> levels(size_t i) const {
+    return {reinterpret_cast<const uint16_t*>(at(i) + sizeof(snapshot::Record)), shape.volume};
+  }
+
+  // The record whose T is closest to T, if one is within tolerance.
+  std::optional<size_t> nearest(double T, double tolerance = INFINITY) const {
+    std::optional<size_t> best;
+    double distance = tolerance;
+    for (size_t i = 0; i < records; i++) {
+      double d = std::abs(record(i).T - T);
+      if (d <= distance) {
+        best = i;
+        distance = d;
+      }
+    }
+    return best;
+  }
+
+  // Writes record i into xy.spins and resyncs xy, e.g. to start a run at a
+  // nearby temperature from an equilibrated configuration.
+  template <typename Lattice>
+  void restore(size_t i, Lattice& xy) const {
+    if (static_cast<uint64_t>(xy.size()) != shape.volume) throw std::invalid_argument("SnapshotReader: lattice size does not match");
+    for (int d = 0; d < static_cast<int>(shape.dimension); d++) {
+      if (static_cast<uint32_t>(xy.extent(d)) != shape.extents[d]) throw std::invalid_argument("SnapshotReader: lattice shape does not match");
+    }
+    auto source = levels(i);
+    xy.spins.resize(source.size());
+    for (size_t s = 0; s < source.size(); s++) xy.spins[s] = snapshot::angle(source[s]);
+    xy.resync();
+  }
+};
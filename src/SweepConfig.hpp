@@ -0,0 +1,119 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+#include <type_traits>
+
+// Setup of a sharded sweep (xy_sweep, xy_merge), read from a plain text file
+// of "key = value" lines; # starts a comment and lists are separated by
+// spaces or commas. Keys left out keep the defaults below. See sweep.cfg.
+struct SweepConfig {
+  int dimension = 2;
+  std::vector<std::string> algorithms = {"Wolff", "Metropolis"};
+  std::vector<int> gridSizes = {256, 128, 64, 32, 16, 8};
+  double Tmin = 0.02, Tmax = 2;
+  int temperatures = 100;
+  int repetitions = 20;
+  int burn = 512;
+  int steps = 512;
+  int overRelax = 4;  // over-relaxation sweeps per heat-bath sweep in Hybrid
+  uint64_t seed = 20240601;
+  std::string output = "../data/data.hdf5";
+  int shards = 1;
+  int clockLevels = 0;  // q of the Z_q clock model (power of two), 0 for XY
+
+  std::vector<double> T() const {
+    std::vector<double> result(temperatures, Tmin);
+    for (int i = 1; i < temperatures; i++) result[i] = Tmin + i * (Tmax - Tmin) / (temperatures - 1);
+    return result;
+  }
+
+  // Every (algorithm, grid, rep, T) point in a fixed order; point u belongs
+  // to shard u % shards, which spreads every grid size over all shards.
+  size_t points() const { return algorithms.size() * gridSizes.size() * repetitions * temperatures; }
+
+  // The output of one shard: data.hdf5 -> data.shard-3-of-16.hdf5. A single
+  // shard writes the output itself.
+  std::string shardPath(int shard) const {
+    if (shards == 1) return output;
+    std::filesystem::path path(output);
+    std::string name = path.stem().string() + ".shard-" + std::to_string(shard) + "-of-" + std::to_string(shards);
+    return (path.parent_path() / (name + path.extension().string())).string();
+  }
+};
+
+inline SweepConfig loadSweepConfig(const std::string& file) {
+  std::ifstream in(file);
+  if (!in) throw std::runtime_error("cannot read " + file);
+
+  SweepConfig config;
+  std::string line;
+  for (int number = 1; std::getline(in, line); number++) {
+    line = line.substr(0, line.find('#'));
+    std::replace(line.begin(), line.end(), ',', ' ');
+    size_t equals = line.find('=');
+    std::istringstream key(line.substr(0, equals));
+    std::string name;
+    if (!(key >> name)) continue;
+    if (equals == std::string::npos) {
+      throw std::runtime_error(file + ":" + std::to_string(number) + ": expected key = value");
+    }
+    std::istringstream value(line.substr(equals + 1));
+
+    auto fail = [&] {
+      throw std::runtime_error(file + ":" + std::to_string(number) + ": bad value for " + name);
+    };
+    auto scalar = [&](auto& out) {
+      if (!(value >> out)) fail();
+    };
+    auto list = [&](auto& out) {
+      out.clear();
+      typename std::decay_t<decltype(out)>::value_type item;
+      while (value >> item) out.push_back(item);
+      if (!value.eof() || out.empty()) fail();
+    };
+    if (name == "dimension") scalar(config.dimension);
+    else if (name == "algorithms") list(config.algorithms);
+    else if (name == "gridSizes") list(config.gridSizes);
+    else if (name == "Tmin") scalar(config.Tmin);
+    else if (name == "Tmax") scalar(config.Tmax);
+    else if (name == "temperatures") scalar(config.temperatures);
+    else if (name == "repetitions") scalar(config.repetitions);
+    else if (name == "burn") scalar(config.burn);
+    else if (name == "steps") scalar(config.steps);
+    else if (name == "overRelax") scalar(config.overRelax);
+    else if (name == "seed") scalar(config.seed);
+    else if (name == "output") scalar(config.output);
+    else if (name == "shards") scalar(config.shards);
+    else if (name == "clockLevels") scalar(config.clockLevels);
+    else throw std::runtime_error(file + ":" + std::to_string(number) + ": unknown key " + name);
+  }
+
+  if (config.dimension != 2 && config.dimension != 3) throw std::runtime_error("dimension must be 2 or 3");
+  if (config.shards < 1 || config.temperatures < 2 || config.repetitions < 1) {
+    throw std::runtime_error("shards, temperatures and repetitions must be positive (temperatures at least 2)");
+  }
+  if (config.clockLevels < 0 || config.clockLevels == 1 || config.clockLevels > 1 << 16 ||
+      (config.clockLevels & (config.clockLevels - 1))) {
+    throw std::runtime_error("clockLevels must be 0 or a power of two up to 65536");
+  }
+  for (int N : config.gridSizes) {
+    if (config.clockLevels && N % 2) {
+      throw std::runtime_error("the clock model needs even grid sizes for its checkerboard, not " + std::to_string(N));
+    }
+  }
+  for (const auto& algo : config.algorithms) {
+    if (config.clockLevels && algo != "Wolff" && algo != "Metropolis") {
+      throw std::runtime_error("the clock model runs with Wolff and Metropolis only, not " + algo);
+    }
+    if (algo != "Wolff" && algo != "Metropolis" && algo != "SwendsenWang" && algo != "HeatBath" && algo != "Hybrid") {
+      throw std::runtime_error("unknown algorithm " + algo);
+    }
+  }
+  return config;
+}
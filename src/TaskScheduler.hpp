@@ -0,0 +1,87 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <memory>
+
+// Work-stealing scheduler for a batch of independent tasks. run() sorts the
+// submitted tasks by estimated cost, deals them round-robin onto one deque
+// per worker (so every worker starts on the most expensive work it owns),
+// and lets each worker pop from the front of its own deque and, once that
+// is empty, steal from the back of the others'. Tasks must not submit
+// further tasks.
+class TaskScheduler {
+private:
+  struct Task {
+    double cost;
+    std::function<void()> run;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  int threads;
+  std::vector<Task> submitted;
+
+  static bool popFront(Queue& q, Task& task) {
+    std::lock_guard lock(q.mutex);
+    if (q.tasks.empty()) return false;
+    task = std::move(q.tasks.front());
+    q.tasks.pop_front();
+    return true;
+  }
+
+  static bool popBack(Queue& q, Task& task) {
+    std::lock_guard lock(q.mutex);
+    if (q.tasks.empty()) return false;
+    task = std::move(q.tasks.back());
+    q.tasks.pop_back();
+    return true;
+  }
+
+public:
+  explicit TaskScheduler(int threads_ = std::thread::hardware_concurrency())
+      : threads(std::max(threads_, 1)) {}
+
+  int size() const { return threads; }
+
+  void submit(double cost, std::function<void()> task) {
+    submitted.push_back({cost, std::move(task)});
+  }
+
+  // Executes everything submitted so far and returns when it is done.
+  void run() {
+    std::stable_sort(submitted.begin(), submitted.end(),
+                     [](const Task& a, const Task& b) { return a.cost > b.cost; });
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    for (int i = 0; i < threads; i++) queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < submitted.size(); i++) {
+      queues[i % threads]->tasks.push_back(std::move(submitted[i]));
+    }
+    submitted.clear();
+
+    auto work = [&](int self) {
+      Task task;
+      while (true) {
+        bool found = popFront(*queues[self], task);
+        for (int k = 1; !found && k < threads; k++) {
+          found = popBack(*queues[(self + k) % threads], task);
+        }
+        // Nothing is ever added during run(), so a full empty scan means done.
+        if (!found) return;
+        task.run();
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) workers.emplace_back(work, i);
+    work(0);
+    for (auto& worker : workers) worker.join();
+  }
+};
@@ -0,0 +1,220 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <bit>
+
+// Run telemetry: update statistics of the lattices and a wall-time split of
+// the drivers, gathered without locks and reported as a periodic status line
+// and in the output file. Build with -DXY_TELEMETRY=0 to compile the
+// counters and timers out of the hot paths; progress is still reported.
+#ifndef XY_TELEMETRY
+#define XY_TELEMETRY 1
+#endif
+
+namespace telemetry {
+
+inline constexpr bool enabled = XY_TELEMETRY;
+
+// Wolff cluster sizes are histogrammed in bins [2^k, 2^(k+1)).
+inline constexpr int clusterBins = 32;
+
+// Counters kept by every lattice for the sweeps it has run. Plain integers,
+// since a lattice is only ever updated from one thread at a time.
+struct UpdateStats {
+  uint64_t sweeps = 0;
+  uint64_t attempts = 0, accepted = 0;  // Metropolis
+  uint64_t wolffSweeps = 0, clusters = 0;
+  std::array<uint64_t, clusterBins> clusterSizes{};
+
+  void addCluster(int size) {
+    clusters++;
+    clusterSizes[std::bit_width(static_cast<unsigned>(size)) - 1]++;
+  }
+};
+
+}  // namespace telemetry
+
+// Collects UpdateStats and phase timings from any number of threads. Every
+// thread adds to a shard of its own with relaxed atomics, so recording never
+// contends; readers sum the shards.
+class Telemetry {
+public:
+  enum Phase { Update, Measure, Lock, IO, Phases };
+  static constexpr const char* phaseNames[Phases] = {"update", "measure", "lock", "io"};
+
+  struct Totals {
+    std::array<double, Phases> seconds{};
+    uint64_t sweeps = 0, attempts = 0, accepted = 0, wolffSweeps = 0, clusters = 0;
+    std::array<uint64_t, telemetry::clusterBins> clusterSizes{};
+  };
+
+  // Adds the wall time of its scope to a phase. A null telemetry, or a
+  // build without XY_TELEMETRY, makes it a no-op.
+  class Timer {
+    Telemetry* owner;
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    Timer(Telemetry* owner_, Phase phase_) : owner(owner_), phase(phase_) {
+      if constexpr (telemetry::enabled) {
+        if (owner) start = std::chrono::steady_clock::now();
+      }
+    }
+    Timer(Telemetry& owner_, Phase phase_) : Timer(&owner_, phase_) {}
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    ~Timer() {
+      if constexpr (telemetry::enabled) {
+        if (owner) owner->addTime(phase, std::chrono::steady_clock::now() - start);
+      }
+    }
+  };
+
+private:
+  static constexpr int shardCount = 64;
+
+  struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, Phases> nanos{};
+    std::atomic<uint64_t> sweeps = 0, attempts = 0, accepted = 0, wolffSweeps = 0, clusters = 0;
+    std::array<std::atomic<uint64_t>, telemetry::clusterBins> clusterSizes{};
+  };
+
+  std::array<Shard, shardCount> shards;
+  std::atomic<int> points = 0, total = 0;
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+  std::thread reporter;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  // Threads are given shards round robin on first use.
+  static Shard& local(std::array<Shard, shardCount>& shards) {
+    static std::atomic<int> next = 0;
+    thread_local int slot = next++ % shardCount;
+    return shards[slot];
+  }
+
+  static void bump(std::atomic<uint64_t>& counter, uint64_t value) {
+    if (value) counter.fetch_add(value, std::memory_order_relaxed);
+  }
+
+public:
+  Telemetry() = default;
+  Telemetry(const Telemetry&) = delete;
+  Telemetry& operator=(const Telemetry&) = delete;
+  ~Telemetry() { stopReporting(); }
+
+  void addTime(Phase phase, std::chrono::steady_clock::duration elapsed) {
+    if constexpr (telemetry::enabled) {
+      bump(local(shards).nanos[phase], std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+  }
+
+  // Folds in the statistics a lattice gathered, typically its takeStats().
+  void add(const telemetry::UpdateStats& stats) {
+    if constexpr (telemetry::enabled) {
+      Shard& shard = local(shards);
+      bump(shard.sweeps, stats.sweeps);
+      bump(shard.attempts, stats.attempts);
+      bump(shard.accepted, stats.accepted);
+      bump(shard.wolffSweeps, stats.wolffSweeps);
+      bump(shard.clusters, stats.clusters);
+      for (int k = 0; k < telemetry::clusterBins; k++) bump(shard.clusterSizes[k], stats.clusterSizes[k]);
+    }
+  }
+
+  // Progress in driver-defined points (temperature points, tasks, ...).
+  void addTotal(int n) { total += n; }
+  void pointDone(int n = 1) { points += n; }
+
+  Totals totals() const {
+    Totals t;
+    for (const auto& shard : shards) {
+      for (int p = 0; p < Phases; p++) t.seconds[p] += 1e-9 * shard.nanos[p].load(std::memory_order_relaxed);
+      t.sweeps += shard.sweeps.load(std::memory_order_relaxed);
+      t.attempts += shard.attempts.load(std::memory_order_relaxed);
+      t.accepted += shard.accepted.load(std::memory_order_relaxed);
+      t.wolffSweeps += shard.wolffSweeps.load(std::memory_order_relaxed);
+      t.clusters += shard.clusters.load(std::memory_order_relaxed);
+      for (int k = 0; k < telemetry::clusterBins; k++) {
+        t.clusterSizes[k] += shard.clusterSizes[k].load(std::memory_order_relaxed);
+      }
+    }
+    return t;
+  }
+
+  // One line of JSON: progress, elapsed time and, with XY_TELEMETRY, the
+  // totals so far. Phase seconds are summed over threads.
+  std::string statusLine() const {
+    std::ostringstream os;
+    os.precision(6);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    os << "{\"elapsed\": " << elapsed << ", \"points\": " << points << ", \"total\": " << total;
+    if constexpr (telemetry::enabled) {
+      auto t = totals();
+      os << ", \"sweeps\": " << t.sweeps;
+      if (t.attempts) os << ", \"acceptance\": " << double(t.accepted) / t.attempts;
+      if (t.wolffSweeps) os << ", \"clusters_per_sweep\": " << double(t.clusters) / t.wolffSweeps;
+      os << ", \"seconds\": {";
+      for (int p = 0; p < Phases; p++) os << (p ? ", " : "") << "\"" << phaseNames[p] << "\": " << t.seconds[p];
+      os << "}";
+    }
+    os << "}";
+    return os.str();
+  }
+
+  // Prints statusLine() to out every interval seconds from a background
+  // thread, until stopReporting() or destruction.
+  void startReporting(double interval, std::ostream& out = std::cout) {
+    stopReporting();
+    stopping = false;
+    reporter = std::thread([this, interval, &out] {
+      std::unique_lock lock(mutex);
+      while (!wake.wait_for(lock, std::chrono::duration<double>(interval), [&] { return stopping; })) {
+        out << statusLine() << std::endl;
+      }
+    });
+  }
+
+  void stopReporting() {
+    if (!reporter.joinable()) return;
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    wake.notify_one();
+    reporter.join();
+  }
+
+  // Stores the totals under group: <Phase>Seconds, Sweeps, and where they
+  // apply MetropolisAcceptance, WolffClustersPerSweep and WolffClusterSizes
+  // (the histogram). Replaces what an earlier session wrote there.
+  template <typename Store>
+  void write(Store& store, const std::string& group) const {
+    if constexpr (telemetry::enabled) {
+      auto t = totals();
+      const char* names[Phases] = {"UpdateSeconds", "MeasureSeconds", "LockSeconds", "IOSeconds"};
+      for (int p = 0; p < Phases; p++) store.write(group + "/" + names[p], t.seconds[p]);
+      store.write(group + "/Sweeps", t.sweeps);
+      if (t.attempts) store.write(group + "/MetropolisAcceptance", double(t.accepted) / t.attempts);
+      if (t.wolffSweeps) {
+        int bins = telemetry::clusterBins;
+        while (bins > 1 && t.clusterSizes[bins - 1] == 0) bins--;
+        store.write(group + "/WolffClustersPerSweep", double(t.clusters) / t.wolffSweeps);
+        store.write(group + "/WolffClusterSizes", std::vector(t.clusterSizes.begin(), t.clusterSizes.begin() + bins));
+      }
+    }
+  }
+};
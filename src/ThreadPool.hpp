@@ -0,0 +1,86 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+// Small fixed-size pool for data-parallel work inside a single lattice.
+// run(task) calls task(tid) once on every worker, the calling thread acting
+// as worker 0, and returns when all of them are done.
+class ThreadPool {
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::function<void(int)> task;
+  unsigned long generation = 0;
+  int pending = 0;
+  bool stopping = false;
+
+  void work(int tid) {
+    unsigned long seen = 0;
+    while (true) {
+      {
+        std::unique_lock lock(mutex);
+        wake.wait(lock, [&]{ return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+      }
+      task(tid);
+      {
+        std::lock_guard lock(mutex);
+        if (--pending == 0) done.notify_one();
+      }
+    }
+  }
+
+public:
+  explicit ThreadPool(int threads) {
+    for (int tid = 1; tid < std::max(threads, 1); tid++) {
+      workers.emplace_back(&ThreadPool::work, this, tid);
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+  }
+
+  int size() const { return static_cast<int>(workers.size()) + 1; }
+
+  void run(std::function<void(int)> f) {
+    if (workers.empty()) {
+      f(0);
+      return;
+    }
+    {
+      std::lock_guard lock(mutex);
+      task = std::move(f);
+      pending = static_cast<int>(workers.size());
+      generation++;
+    }
+    wake.notify_all();
+    task(0);
+    std::unique_lock lock(mutex);
+    done.wait(lock, [&]{ return pending == 0; });
+  }
+
+  // Splits [0, n) into size() contiguous blocks, block tid going to worker tid.
+  void parallelFor(int n, const std::function<void(int begin, int end, int tid)>& f) {
+    int threads = size();
+    run([&](int tid) {
+      int begin = static_cast<long>(n) * tid / threads;
+      int end = static_cast<long>(n) * (tid + 1) / threads;
+      if (begin < end) f(begin, end, tid);
+    });
+  }
+};
@@ -0,0 +1,590 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <concepts>
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#endif
+#include "ThreadPool.hpp"
+#include "FastMath.hpp"
+#include "Random.hpp"
+
+// Allocator for spin arrays. With huge set, blocks of 2 MB and up are
+// aligned to 2 MB and the kernel is asked to back them with transparent huge
+// pages, so that a lattice of 100 MB needs a few dozen TLB entries rather
+// than tens of thousands. Without it, or where madvise is missing, it is
+// std::allocator.
+template <typename T>
+struct SpinAllocator {
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  static constexpr size_t hugePage = 2 << 20;
+
+  bool huge = false;
+
+  SpinAllocator() = default;
+  explicit SpinAllocator(bool huge_) : huge(huge_) {}
+  template <typename U>
+  SpinAllocator(const SpinAllocator<U>& other) : huge(other.huge) {}
+
+  T* allocate(size_t n) {
+    size_t bytes = n * sizeof(T);
+    if (!huge || bytes < hugePage) return std::allocator<T>().allocate(n);
+    bytes = (bytes + hugePage - 1) / hugePage * hugePage;
+    void* p = std::aligned_alloc(hugePage, bytes);
+    if (!p) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (!huge || n * sizeof(T) < hugePage) std::allocator<T>().deallocate(p, n);
+    else std::free(p);
+  }
+
+  template <typename U>
+  bool operator==(const SpinAllocator<U>& other) const { return huge == other.huge; }
+};
+
+// XY model on a periodic D-dimensional hypercubic lattice, as XYLattice,
+// with the spins stored in cache-sized tiles instead of row-major. In 3D a
+// row-major sweep finds the +-z neighbours a whole plane away (512 KB at
+// L = 256), and a Wolff cluster touches a new page at nearly every step.
+//
+// Layout::Tiled cuts the lattice into bricks of 32^2, 8^3 or 4^4 sites
+// (8, 4 and 2 KB), stored one after another and row-major inside; extents
+// that are not multiples get the largest power of two that divides them.
+// Layout::Morton orders the sites along the Z-order curve, which nests such
+// bricks at every scale; it needs equal extents that are powers of two. In
+// both, the index of a site is a sum of one table entry per axis, so
+// neighbours still follow by index arithmetic.
+//
+// Metropolis sweeps tile by tile, each half of the checkerboard in turn.
+// Random numbers are drawn as in XYLattice (per row-major site index for
+// Metropolis, from Rng in the same order for Wolff and initializeData()),
+// so for equal (seed, stream) both lattices go through the same
+// configurations; only the running totals are summed in another order.
+// rowMajor() and setRowMajor() convert.
+template <int D, typename Rng = prng::Xoshiro256pp>
+class TiledLattice {
+  static_assert(D >= 2 && D <= 4, "TiledLattice supports 2, 3 and 4 dimensions");
+
+public:
+  enum class Layout { Tiled, Morton };
+
+private:
+  static constexpr int preferredEdge = D == 2 ? 32 : D == 3 ? 8 : 4;
+
+  Rng rng;
+  prng::SiteStream siteStream;
+  uint64_t streamSweeps = 0;
+  std::uniform_real_distribution<double> rand{0.0, 1.0};
+  std::uniform_real_distribution<double> randPI{0.0, 2 * M_PI};
+
+  Layout layout_;
+  std::array<int, D> L;
+  std::array<int, D> stride;  // row-major, for the per-site random numbers
+  std::array<int, D> edge;    // tile extents
+  int volume = 1;
+  int tileVolume = 1;
+
+  // Index of a site: sum over d of offset[d][x_d].
+  std::array<std::vector<int>, D> offset;
+  // First site of every tile, in storage order.
+  std::vector<std::array<int, D>> tileOrigin;
+
+  std::unique_ptr<ThreadPool> pool;
+  bool vectorized = false;
+  struct TileScratch {
+    std::vector<double> theta, neighbor, delta, u, out, de, dmx, dmy;
+    std::vector<int> site, global;
+  };
+  std::vector<TileScratch> scratch;
+
+  struct Site {
+    int index;
+    std::array<int, D> x;
+  };
+  std::vector<unsigned> visited;
+  unsigned generation = 0;
+  std::vector<Site> stack;
+  int wolffClusters = 0;
+  // XYLattice::wolffBudget.
+  double wolffSites = 0;
+  long wolffCount = 0;
+  float wolffT = -1;
+
+  double energySum = 0, mxSum = 0, mySum = 0;
+  int resyncInterval = 1000;
+  int sweepsSinceResync = 0;
+
+  struct Delta {
+    double e = 0, mx = 0, my = 0;
+  };
+  std::vector<Delta> tileDeltas;
+
+  // A row along axis 0, fixed by its coordinates on the other axes.
+  struct Row {
+    int base = 0;    // index of x = 0
+    int global = 0;  // row-major index of x = 0
+    int parity = 0;
+    std::array<int, 2 * (D - 1)> offsets{};  // +/- neighbour rows, axis by axis
+  };
+
+  int forward(int d, int c) const { return c + 1 == L[d] ? 0 : c + 1; }
+  int backward(int d, int c) const { return c == 0 ? L[d] - 1 : c - 1; }
+
+  Row row(const std::array<int, D>& x) const {
+    Row row;
+    for (int d = 1; d < D; d++) {
+      int c = x[d];
+      row.base += offset[d][c];
+      row.global += c * stride[d];
+      row.parity += c;
+      row.offsets[2 * (d - 1)] = offset[d][forward(d, c)] - offset[d][c];
+      row.offsets[2 * (d - 1) + 1] = offset[d][backward(d, c)] - offset[d][c];
+    }
+    row.parity &= 1;
+    return row;
+  }
+
+  // Row r of the whole lattice, in row-major order.
+  Row latticeRow(int r) const {
+    std::array<int, D> x{};
+    for (int d = 1; d < D; d++) {
+      x[d] = r % L[d];
+      r /= L[d];
+    }
+    return row(x);
+  }
+
+  // Row j of tile t.
+  Row tileRow(int t, int j) const {
+    std::array<int, D> x = tileOrigin[t];
+    for (int d = 1; d < D; d++) {
+      x[d] += j % edge[d];
+      j /= edge[d];
+    }
+    return row(x);
+  }
+
+  int rows() const { return volume / L[0]; }
+  int tileRows() const { return tileVolume / edge[0]; }
+  int tiles() const { return volume / tileVolume; }
+
+  // Stencil of site x on a row, in XYLattice's order: +x and -x first.
+  std::array<int, 2 * D> neighbors(const Row& row, int x) const {
+    int s = row.base + offset[0][x];
+    std::array<int, 2 * D> nb;
+    nb[0] = row.base + offset[0][forward(0, x)];
+    nb[1] = row.base + offset[0][backward(0, x)];
+    for (int k = 0; k < 2 * (D - 1); k++) nb[2 + k] = s + row.offsets[k];
+    return nb;
+  }
+
+  void prepareLayout() {
+    for (int d = 0; d < D; d++) {
+      if (L[d] % 2) throw std::invalid_argument("TiledLattice needs even extents for the checkerboard");
+    }
+    if (layout_ == Layout::Morton) {
+      for (int d = 0; d < D; d++) {
+        if (L[d] != L[0] || (L[d] & (L[d] - 1))) {
+          throw std::invalid_argument("the Morton layout needs equal extents that are powers of two");
+        }
+      }
+    }
+
+    tileVolume = 1;
+    for (int d = 0; d < D; d++) {
+      edge[d] = layout_ == Layout::Morton ? std::min(L[d], preferredEdge) : std::gcd(L[d], preferredEdge);
+      tileVolume *= edge[d];
+    }
+
+    int tileStride = tileVolume, inner = 1;
+    for (int d = 0; d < D; d++) {
+      offset[d].resize(L[d]);
+      for (int c = 0; c < L[d]; c++) {
+        if (layout_ == Layout::Morton) {
+          int m = 0;
+          for (int b = 0; (c >> b) > 0; b++) m |= ((c >> b) & 1) << (b * D + d);
+          offset[d][c] = m;
+        } else {
+          offset[d][c] = c / edge[d] * tileStride + c % edge[d] * inner;
+        }
+      }
+      tileStride *= L[d] / edge[d];
+      inner *= edge[d];
+    }
+
+    tileOrigin.resize(tiles());
+    for (int t = 0; t < tiles(); t++) {
+      std::array<int, D> x;
+      int first = 0;
+      for (int d = 0, rest = t; d < D; d++) {
+        x[d] = rest % (L[d] / edge[d]) * edge[d];
+        rest /= L[d] / edge[d];
+        first += offset[d][x[d]];
+      }
+      tileOrigin[first / tileVolume] = x;
+    }
+  }
+
+  void prepareScratch() {
+    const int m = tileVolume / 2;
+    scratch.resize(threads());
+    for (auto& w : scratch) {
+      for (auto* v : {&w.theta, &w.delta, &w.u, &w.out, &w.de, &w.dmx, &w.dmy}) v->resize(m);
+      w.neighbor.resize(2 * D * m);
+      w.site.resize(m);
+      w.global.resize(m);
+    }
+  }
+
+  unsigned nextGeneration() {
+    if (++generation == 0) {
+      std::fill(visited.begin(), visited.end(), 0);
+      generation = 1;
+    }
+    return generation;
+  }
+
+  void apply(const Delta& d) {
+    energySum += d.e;
+    mxSum += d.mx;
+    mySum += d.my;
+  }
+
+  void countSweep() {
+    if (++sweepsSinceResync >= resyncInterval) resync();
+  }
+
+  double random() { return rand(rng); }
+  double randomAngle() { return randPI(rng); }
+
+  // XYLattice::metropolisStep.
+  void metropolisStep(int s, const std::array<int, 2 * D>& nb, double delta, double u, Delta& d) {
+    double energy_now = 0, energy_after = 0;
+    for (int n : nb) {
+      energy_now -= std::cos(spins[s] - spins[n]);
+      energy_after -= std::cos(spins[s] + delta - spins[n]);
+    }
+
+    if (energy_after < energy_now || u < std::exp(-(energy_after - energy_now) / T)) {
+      double old = spins[s];
+      spins[s] = std::fmod(old + delta + 2 * M_PI, 2 * M_PI);
+      d.e += energy_after - energy_now;
+      d.mx += std::cos(spins[s]) - std::cos(old);
+      d.my += std::sin(spins[s]) - std::sin(old);
+    }
+  }
+
+  void metropolisTile(int t, int color, Delta& d) {
+    const int x0 = tileOrigin[t][0];
+    for (int j = 0; j < tileRows(); j++) {
+      Row current = tileRow(t, j);
+      for (int x = x0 + ((current.parity + x0 + color) & 1); x < x0 + edge[0]; x += 2) {
+        double delta, u;
+        siteStream.uniforms(streamSweeps, current.global + x, 0, delta, u);
+        metropolisStep(current.base + offset[0][x], neighbors(current, x), 2 * M_PI * delta, u, d);
+      }
+    }
+  }
+
+  // XYLattice::metropolisRowSimd on the sites of one colour in a tile, which
+  // makes for longer vectors than a row of a tile.
+  void metropolisTileSimd(int t, int color, TileScratch& w, Delta& d) {
+    const int m = tileVolume / 2;
+    const int x0 = tileOrigin[t][0];
+    int n = 0;
+    for (int j = 0; j < tileRows(); j++) {
+      Row current = tileRow(t, j);
+      for (int x = x0 + ((current.parity + x0 + color) & 1); x < x0 + edge[0]; x += 2, n++) {
+        auto nb = neighbors(current, x);
+        w.site[n] = current.base + offset[0][x];
+        w.global[n] = current.global + x;
+        w.theta[n] = spins[w.site[n]];
+        for (int k = 0; k < 2 * D; k++) w.neighbor[k * m + n] = spins[nb[k]];
+      }
+    }
+    for (int i = 0; i < n; i++) {
+      siteStream.uniforms(streamSweeps, w.global[i], 0, w.delta[i], w.u[i]);
+      w.delta[i] *= 2 * M_PI;
+    }
+
+    const double beta = 1.0 / T;
+    const double* __restrict theta = w.theta.data();
+    const double* __restrict neighbor = w.neighbor.data();
+    const double* __restrict delta = w.delta.data();
+    const double* __restrict u = w.u.data();
+    double* __restrict out = w.out.data();
+    double* __restrict de = w.de.data();
+    double* __restrict dmx = w.dmx.data();
+    double* __restrict dmy = w.dmy.data();
+
+    for (int i = 0; i < n; i++) {
+      double moved = theta[i] + delta[i];
+      double energy_now = 0, energy_after = 0;
+      for (int k = 0; k < 2 * D; k++) {
+        energy_now -= fastmath::cos(theta[i] - neighbor[k * m + i]);
+        energy_after -= fastmath::cos(moved - neighbor[k * m + i]);
+      }
+      double dE = energy_after - energy_now;
+      bool accept = (dE < 0) | (u[i] < fastmath::expNegative(-dE * beta));
+      moved = moved >= 2 * M_PI ? moved - 2 * M_PI : moved;
+      out[i] = accept ? moved : theta[i];
+      de[i] = accept ? dE : 0.0;
+      dmx[i] = accept ? fastmath::cos(moved) - fastmath::cos(theta[i]) : 0.0;
+      dmy[i] = accept ? fastmath::sin(moved) - fastmath::sin(theta[i]) : 0.0;
+    }
+
+    for (int i = 0; i < n; i++) {
+      spins[w.site[i]] = out[i];
+      d.e += de[i];
+      d.mx += dmx[i];
+      d.my += dmy[i];
+    }
+  }
+
+public:
+  std::vector<double, SpinAllocator<double>> spins;
+  float T = 1.0;
+
+  template <std::integral... Ns>
+    requires (sizeof...(Ns) == D)
+  explicit TiledLattice(Layout layout, Ns... n) : layout_(layout), L{static_cast<int>(n)...} {
+    std::random_device device;
+    seed((static_cast<uint64_t>(device()) << 32) | device());
+    for (int d = 0; d < D; d++) {
+      stride[d] = volume;
+      volume *= L[d];
+    }
+    prepareLayout();
+    spins.assign(volume, 0.0);
+    visited.assign(volume, 0);
+    stack.reserve(std::min(volume, 1 << 16));
+    setThreads(1);
+    resync();
+  }
+
+  // As XYLattice::seed.
+  void seed(uint64_t seed, uint64_t stream = 0) {
+    uint64_t key = prng::streamKey(seed, stream);
+    if constexpr (std::constructible_from<Rng, uint64_t, uint64_t>) {
+      rng = Rng(seed, stream);
+    } else {
+      rng = Rng(static_cast<typename Rng::result_type>(key));
+    }
+    siteStream = prng::SiteStream(prng::streamKey(key, 1));
+    streamSweeps = 0;
+  }
+
+  int size() const { return volume; }
+  int extent(int d) const { return L[d]; }
+  Layout layout() const { return layout_; }
+  int tileSize() const { return tileVolume; }
+  int clustersLastSweep() const { return wolffClusters; }
+
+  // Index in spins of the site with coordinates x.
+  int index(const std::array<int, D>& x) const {
+    int s = 0;
+    for (int d = 0; d < D; d++) s += offset[d][x[d]];
+    return s;
+  }
+
+  // Moves the spins to memory backed by transparent huge pages (or back).
+  void useHugePages(bool on) {
+    std::vector<double, SpinAllocator<double>> moved(spins.begin(), spins.end(), SpinAllocator<double>(on));
+    spins = std::move(moved);
+  }
+
+  // Threads used by Metropolis(), which splits each half-sweep over tiles.
+  void setThreads(int threads) {
+    threads = std::max(threads, 1);
+    pool = threads > 1 ? std::make_unique<ThreadPool>(threads) : nullptr;
+    prepareScratch();
+  }
+
+  int threads() const { return pool ? pool->size() : 1; }
+
+  // As XYLattice::setVectorized.
+  void setVectorized(bool on) { vectorized = on; }
+  bool isVectorized() const { return vectorized; }
+
+  void initializeData(bool aligned = false) {
+    if (aligned) {
+      std::fill(spins.begin(), spins.end(), randomAngle());
+    } else {
+      for (int r = 0; r < rows(); r++) {
+        Row current = latticeRow(r);
+        for (int x = 0; x < L[0]; x++) spins[current.base + offset[0][x]] = randomAngle();
+      }
+    }
+    resync();
+  }
+
+  // The spins in XYLattice's row-major order, and back.
+  std::vector<double> rowMajor() const {
+    std::vector<double> result(volume);
+    for (int r = 0; r < rows(); r++) {
+      Row current = latticeRow(r);
+      for (int x = 0; x < L[0]; x++) result[current.global + x] = spins[current.base + offset[0][x]];
+    }
+    return result;
+  }
+
+  void setRowMajor(const std::vector<double>& values) {
+    for (int r = 0; r < rows(); r++) {
+      Row current = latticeRow(r);
+      for (int x = 0; x < L[0]; x++) spins[current.base + offset[0][x]] = values[current.global + x];
+    }
+    resync();
+  }
+
+  // Recomputes the running totals from spins.
+  void resync() {
+    mxSum = mySum = 0;
+    for (const double& spin : spins) {
+      mxSum += std::cos(spin);
+      mySum += std::sin(spin);
+    }
+    energySum = Energy() * volume;
+    sweepsSinceResync = 0;
+  }
+
+  void setResyncInterval(int sweeps) { resyncInterval = std::max(sweeps, 1); }
+
+  double currentEnergy() const { return energySum / volume; }
+  double currentMagnetization() const { return std::hypot(mxSum, mySum) / volume; }
+
+  double Magnetization() const {
+    double sumX = 0, sumY = 0;
+    for (const double& spin : spins) {
+      sumX += std::cos(spin);
+      sumY += std::sin(spin);
+    }
+    return std::hypot(sumX, sumY) / volume;
+  }
+
+  // Every bond once, through the +1 neighbour on each axis; tile by tile.
+  double Energy() const {
+    double sum = 0;
+    for (int t = 0; t < tiles(); t++) {
+      const int x0 = tileOrigin[t][0];
+      for (int j = 0; j < tileRows(); j++) {
+        Row current = tileRow(t, j);
+        for (int x = x0; x < x0 + edge[0]; x++) {
+          int s = current.base + offset[0][x];
+          sum -= std::cos(spins[s] - spins[current.base + offset[0][forward(0, x)]]);
+          for (int d = 1; d < D; d++) sum -= std::cos(spins[s] - spins[s + current.offsets[2 * (d - 1)]]);
+        }
+      }
+    }
+    return sum / volume;
+  }
+
+  // Checkerboard sweep, each half tile by tile; the tiles are split over the
+  // pool and their totals summed in tile order.
+  void Metropolis() {
+    tileDeltas.assign(tiles(), Delta{});
+    for (int color = 0; color < 2; color++) {
+      auto half = [&](int begin, int end, int tid) {
+        for (int t = begin; t < end; t++) {
+          if (vectorized) metropolisTileSimd(t, color, scratch[tid], tileDeltas[t]);
+          else metropolisTile(t, color, tileDeltas[t]);
+        }
+      };
+      if (pool) pool->parallelFor(tiles(), half);
+      else half(0, tiles(), 0);
+    }
+    for (const auto& d : tileDeltas) apply(d);
+    streamSweeps++;
+    countSweep();
+  }
+
+  // XYLattice::wolffBudget.
+  int wolffBudget() {
+    if (T != wolffT) {
+      wolffT = T;
+      wolffSites = 0;
+      wolffCount = 0;
+    }
+    if (wolffCount == 0) return 1;
+    return std::max(1, static_cast<int>(std::ceil(volume * wolffCount / wolffSites)));
+  }
+
+  // XYLattice::Wolff, with neighbours by the offset tables.
+  void Wolff() {
+    const int clusters = wolffBudget();
+    int flippedSpins = 0;
+
+    for (int i = 0; i < clusters; i++) {
+      auto r = randomAngle();
+      unsigned stamp = nextGeneration();
+      int clusterSize = 0;
+      double projSum = 0;
+
+      Site seed{0, {}};
+      for (int d = 0, rest = static_cast<int>(random() * volume); d < D; d++) {
+        seed.x[d] = rest % L[d];
+        rest /= L[d];
+      }
+      seed.index = index(seed.x);
+      visited[seed.index] = stamp;
+      stack.push_back(seed);
+
+      while (!stack.empty()) {
+        Site site = stack.back();
+        stack.pop_back();
+        int s = site.index;
+
+        double proj = std::cos(r - spins[s]);
+        spins[s] = std::fmod(2 * r - spins[s] + 3 * M_PI, 2 * M_PI);
+
+        for (int d = 0; d < D; d++) {
+          int c = site.x[d];
+          for (int next : {forward(d, c), backward(d, c)}) {
+            Site neighbor = site;
+            neighbor.x[d] = next;
+            neighbor.index = s + offset[d][next] - offset[d][c];
+
+            double projNeighbor = std::cos(r - spins[neighbor.index]);
+            energySum += 2 * proj * projNeighbor;
+            if (
+              visited[neighbor.index] != stamp &&
+              (random() < 1 - std::exp(std::min(0.0, -2 / T * proj * projNeighbor)))
+            ) {
+              visited[neighbor.index] = stamp;
+              stack.push_back(neighbor);
+            }
+          }
+        }
+        projSum += proj;
+        clusterSize++;
+      }
+      mxSum -= 2 * projSum * std::cos(r);
+      mySum -= 2 * projSum * std::sin(r);
+
+      flippedSpins += clusterSize;
+    }
+    wolffSites += flippedSpins;
+    wolffCount += clusters;
+    wolffClusters = clusters;
+    countSweep();
+  }
+};
+
+using TiledModel = TiledLattice<2>;
+using TiledModel3D = TiledLattice<3>;
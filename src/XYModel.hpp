@@ -1,40 +1,569 @@
 #pragma once
 #include <iostream>
 #include <vector>
-#include <queue>
+#include <array>
 #include <random>
 #include <cmath>
 #include <algorithm>
 #include <functional>
+#include <memory>
+#include <concepts>
+#include <atomic>
+#include <sstream>
+#include <bit>
+#include <string>
+#include <utility>
+#include "ThreadPool.hpp"
+#include "FastMath.hpp"
+#include "Random.hpp"
+#include "Telemetry.hpp"
+
+// XY model on a periodic D-dimensional hypercubic lattice. Spins are stored
+// row-major with axis 0 (x) fastest. Periodic neighbours are found with a
+// conditional wrap instead of %, and the 2*D stencil is unrolled at compile
+// time for every D. Rng is the sequential generator behind initializeData()
+// and Wolff(); any UniformRandomBitGenerator constructible from a seed works.
+template <int D, typename Rng = prng::Xoshiro256pp>
+class XYLattice {
+  static_assert(D >= 2 && D <= 4, "XYLattice supports 2, 3 and 4 dimensions");
 
-class XYModel {
 private:
-  std::mt19937 rng;
+  Rng rng;
+  // Checkerboard Metropolis and Swendsen-Wang draw their numbers per
+  // (sweep, site, tag) from a counter-based stream, so a sweep is the same
+  // whatever the thread count. Tags: 0 Metropolis, 1-3 Swendsen-Wang, 4 and
+  // up heat bath, and the last one the Swendsen-Wang axis, which must not
+  // share a counter with any site's draws.
+  prng::SiteStream siteStream;
+  static constexpr uint32_t axisTag = UINT32_MAX;
+  uint64_t streamSweeps = 0;
   std::uniform_real_distribution<double> rand;
   std::uniform_real_distribution<double> randPI;
-  int Nx, Ny;
+  std::array<int, D> L;
+  std::array<int, D> stride;
+  int volume = 1;
+
+  std::unique_ptr<ThreadPool> pool;
+
+  // Vectorized Metropolis: the same-colour sites of a row are gathered into
+  // contiguous buffers, updated in one loop the compiler turns into SIMD
+  // code, and scattered back. One set of buffers per worker.
+  bool vectorized = false;
+  struct RowScratch {
+    std::vector<double> theta, neighbor, delta, u, out, de, dmx, dmy;
+    std::vector<uint32_t> site;
+  };
+  std::vector<RowScratch> scratch;
+
+  // Wolff workspace, kept across clusters so that one costs O(cluster size):
+  // a site is visited when its stamp equals the current cluster generation,
+  // so nothing needs clearing between clusters. Stack entries carry their
+  // coordinates, so neighbours never have to be decoded from the index.
+  struct Site {
+    int index;
+    std::array<int, D> x;
+  };
+  std::vector<unsigned> visited;
+  unsigned generation = 0;
+  std::vector<Site> stack;
+  int wolffClusters = 0;  // built by the last Wolff() sweep
+  // Sites flipped and clusters built by Wolff() since T last changed, which
+  // set the number of clusters per sweep; see wolffBudget().
+  double wolffSites = 0;
+  long wolffCount = 0;
+  float wolffT = -1;
+  telemetry::UpdateStats stats;
+
+  // Swendsen-Wang workspace: projections on the reflection axis, a
+  // concurrent union-find forest over the sites, and the per-site flip flag.
+  // Allocated on first use.
+  std::vector<double> projection;
+  std::unique_ptr<std::atomic<int>[]> parent;
+  std::vector<char> flipped;
+
+  // Running totals of the bond energy and of the magnetization components,
+  // updated by the kernels and recomputed from scratch every resyncInterval
+  // sweeps to keep rounding drift bounded.
+  double energySum = 0, mxSum = 0, mySum = 0;
+  int resyncInterval = 1000;
+  int sweepsSinceResync = 0;
+
+  struct Delta {
+    double e = 0, mx = 0, my = 0;
+    long accepted = 0;  // Metropolis moves, with telemetry
+  };
+  std::vector<Delta> rowDeltas;
+
+  // A row runs along axis 0 and is fixed by its coordinates on the others.
+  struct Row {
+    int base = 0;    // index of x = 0
+    int parity = 0;  // sum of the other coordinates, mod 2
+    std::array<int, 2 * (D - 1)> offsets{};  // +/- neighbour rows, axis by axis
+  };
+
+  int forward(int d, int c) const { return c + 1 == L[d] ? 0 : c + 1; }
+  int backward(int d, int c) const { return c == 0 ? L[d] - 1 : c - 1; }
+
+  Row row(int r) const {
+    Row row;
+    for (int d = 1; d < D; d++) {
+      int c = r % L[d];
+      r /= L[d];
+      row.base += c * stride[d];
+      row.parity += c;
+      row.offsets[2 * (d - 1)] = (forward(d, c) - c) * stride[d];
+      row.offsets[2 * (d - 1) + 1] = (backward(d, c) - c) * stride[d];
+    }
+    row.parity &= 1;
+    return row;
+  }
+
+  int rows() const { return volume / L[0]; }
+
+  // Stencil of site x on a row, +x and -x first.
+  std::array<int, 2 * D> neighbors(const Row& row, int x) const {
+    int s = row.base + x;
+    std::array<int, 2 * D> nb;
+    nb[0] = row.base + forward(0, x);
+    nb[1] = row.base + backward(0, x);
+    for (int k = 0; k < 2 * (D - 1); k++) nb[2 + k] = s + row.offsets[k];
+    return nb;
+  }
+
+  void prepareWorkspace() {
+    visited.assign(volume, 0);
+    generation = 0;
+    stack.clear();
+    stack.reserve(std::min(volume, 1 << 16));
+  }
+
+  unsigned nextGeneration() {
+    if (++generation == 0) {
+      std::fill(visited.begin(), visited.end(), 0);
+      generation = 1;
+    }
+    return generation;
+  }
+
+  void apply(const Delta& d) {
+    energySum += d.e;
+    mxSum += d.mx;
+    mySum += d.my;
+    if constexpr (telemetry::enabled) stats.accepted += d.accepted;
+  }
+
+  void countSweep() {
+    if constexpr (telemetry::enabled) stats.sweeps++;
+    if (++sweepsSinceResync >= resyncInterval) resync();
+  }
 
   double random() { return rand(rng); }
   double randomAngle() { return randPI(rng); }
 
+  // delta is the proposed rotation, u the uniform for the acceptance test.
+  void metropolisStep(int s, const std::array<int, 2 * D>& nb, double delta, double u, Delta& d) {
+    double energy_now = 0, energy_after = 0;
+    for (int n : nb) {
+      energy_now -= std::cos(spins[s] - spins[n]);
+      energy_after -= std::cos(spins[s] + delta - spins[n]);
+    }
+
+    if (energy_after < energy_now || u < std::exp(-(energy_after - energy_now) / T)) {
+      double old = spins[s];
+      spins[s] = std::fmod(old + delta + 2 * M_PI, 2 * M_PI);
+      d.e += energy_after - energy_now;
+      d.mx += std::cos(spins[s]) - std::cos(old);
+      d.my += std::sin(spins[s]) - std::sin(old);
+      if constexpr (telemetry::enabled) d.accepted++;
+    }
+  }
+
+  void metropolisRow(const Row& row, int start, Delta& d) {
+    for (int x = start; x < L[0]; x += 2) {
+      int s = row.base + x;
+      double delta, u;
+      siteStream.uniforms(streamSweeps, s, 0, delta, u);
+      metropolisStep(s, neighbors(row, x), 2 * M_PI * delta, u, d);
+    }
+  }
+
+  // Same acceptance rule as metropolisStep, on the sites start, start + 2, ...
+  // of a row, with fastmath in place of the libm calls.
+  void metropolisRowSimd(const Row& row, int start, RowScratch& w, Delta& d) {
+    const int m = (L[0] + 1) / 2;
+    int n = 0;
+    for (int x = start; x < L[0]; x += 2, n++) {
+      auto nb = neighbors(row, x);
+      w.site[n] = row.base + x;
+      w.theta[n] = spins[row.base + x];
+      for (int k = 0; k < 2 * D; k++) w.neighbor[k * m + n] = spins[nb[k]];
+    }
+    for (int i = 0; i < n; i++) {
+      siteStream.uniforms(streamSweeps, w.site[i], 0, w.delta[i], w.u[i]);
+      w.delta[i] *= 2 * M_PI;
+    }
+
+    const double beta = 1.0 / T;
+    const double* __restrict theta = w.theta.data();
+    const double* __restrict neighbor = w.neighbor.data();
+    const double* __restrict delta = w.delta.data();
+    const double* __restrict u = w.u.data();
+    double* __restrict out = w.out.data();
+    double* __restrict de = w.de.data();
+    double* __restrict dmx = w.dmx.data();
+    double* __restrict dmy = w.dmy.data();
+
+    for (int i = 0; i < n; i++) {
+      double moved = theta[i] + delta[i];
+      double energy_now = 0, energy_after = 0;
+      for (int k = 0; k < 2 * D; k++) {
+        energy_now -= fastmath::cos(theta[i] - neighbor[k * m + i]);
+        energy_after -= fastmath::cos(moved - neighbor[k * m + i]);
+      }
+      double dE = energy_after - energy_now;
+      bool accept = (dE < 0) | (u[i] < fastmath::expNegative(-dE * beta));
+      moved = moved >= 2 * M_PI ? moved - 2 * M_PI : moved;
+      out[i] = accept ? moved : theta[i];
+      de[i] = accept ? dE : 0.0;
+      dmx[i] = accept ? fastmath::cos(moved) - fastmath::cos(theta[i]) : 0.0;
+      dmy[i] = accept ? fastmath::sin(moved) - fastmath::sin(theta[i]) : 0.0;
+    }
+
+    n = 0;
+    for (int x = start; x < L[0]; x += 2, n++) {
+      spins[row.base + x] = out[n];
+      d.e += de[n];
+      d.mx += dmx[n];
+      d.my += dmy[n];
+      if constexpr (telemetry::enabled) d.accepted += out[n] != theta[n];
+    }
+  }
+
+  // Red/black sweep: sites of one colour only couple to the other colour,
+  // so each half-sweep can be split over rows without any locking.
+  // Deltas are kept per row and summed in row order, so that the running
+  // totals are bit-identical for any thread count too.
+  void MetropolisCheckerboard() {
+    rowDeltas.assign(rows(), Delta{});
+    for (int color = 0; color < 2; color++) {
+      auto half = [&](int begin, int end, int tid) {
+        for (int r = begin; r < end; r++) {
+          Row current = row(r);
+          int start = (current.parity + color) & 1;
+          if (vectorized) {
+            metropolisRowSimd(current, start, scratch[tid], rowDeltas[r]);
+          } else {
+            metropolisRow(current, start, rowDeltas[r]);
+          }
+        }
+      };
+      if (pool) {
+        pool->parallelFor(rows(), half);
+      } else {
+        half(0, rows(), 0);
+      }
+    }
+    for (const auto& d : rowDeltas) apply(d);
+    streamSweeps++;
+  }
+
+  // Heat bath and over-relaxation work on the spins as unit vectors: the
+  // cosines and sines are tabulated once and kept current as spins move, so
+  // an update needs one atan2 instead of a dozen trig calls. Every other
+  // writer of spins clears tablesValid, so that successive heat-bath and
+  // over-relaxation sweeps (Hybrid) share one tabulation.
+  std::vector<double> cosine, sine;
+  bool tablesValid = false;
+
+  // fast: fastmath in place of libm, vectorized; for measurements.
+  void tabulate(bool fast = false) {
+    cosine.resize(volume);
+    sine.resize(volume);
+    forRows([&](int begin, int end, int) {
+      const int first = row(begin).base, last = end < rows() ? row(end).base : volume;
+      if (fast) {
+        for (int s = first; s < last; s++) {
+          cosine[s] = fastmath::cos(spins[s]);
+          sine[s] = fastmath::sin(spins[s]);
+        }
+      } else {
+        for (int s = first; s < last; s++) {
+          cosine[s] = std::cos(spins[s]);
+          sine[s] = std::sin(spins[s]);
+        }
+      }
+    });
+  }
+
+  // Local field h = sum of the neighbouring spins.
+  void localField(const std::array<int, 2 * D>& nb, double& hx, double& hy) const {
+    hx = hy = 0;
+    for (int n : nb) {
+      hx += cosine[n];
+      hy += sine[n];
+    }
+  }
+
+  // Turns spin s into the unit vector (c, sn) and records the change.
+  void moveSpin(int s, double c, double sn, double hx, double hy, Delta& d) {
+    d.e -= hx * (c - cosine[s]) + hy * (sn - sine[s]);
+    d.mx += c - cosine[s];
+    d.my += sn - sine[s];
+    cosine[s] = c;
+    sine[s] = sn;
+    double angle = std::atan2(sn, c);
+    spins[s] = angle < 0 ? angle + 2 * M_PI : angle;
+  }
+
+  // Reflects spin s about its local field: the energy is unchanged, so
+  // there is nothing to accept or reject and no random number is needed.
+  void overRelaxStep(int s, const std::array<int, 2 * D>& nb, Delta& d) {
+    double hx, hy;
+    localField(nb, hx, hy);
+    double h2 = hx * hx + hy * hy;
+    if (h2 == 0) return;
+    double dot = (cosine[s] * hx + sine[s] * hy) / h2;
+    moveSpin(s, 2 * dot * hx - cosine[s], 2 * dot * hy - sine[s], hx, hy, d);
+  }
+
+  // Draws spin s from its exact conditional distribution, the von Mises
+  // distribution exp(kappa cos(theta - phi)) with kappa = beta |h| and phi
+  // the field angle, by Best and Fisher's rejection method (acceptance above
+  // 65 % for any kappa). Attempt a uses stream tags 4 + 2a and 5 + 2a.
+  void heatBathStep(int s, const std::array<int, 2 * D>& nb, Delta& d) {
+    double hx, hy;
+    localField(nb, hx, hy);
+    const double h = std::hypot(hx, hy);
+    const double kappa = h / T;
+
+    double u1, u2, u3, unused;
+    if (kappa < 1e-8) {
+      siteStream.uniforms(streamSweeps, s, 4, u1, unused);
+      moveSpin(s, std::cos(2 * M_PI * u1), std::sin(2 * M_PI * u1), hx, hy, d);
+      return;
+    }
+    const double tau = 1 + std::sqrt(1 + 4 * kappa * kappa);
+    const double rho = (tau - std::sqrt(2 * tau)) / (2 * kappa);
+    const double r = (1 + rho * rho) / (2 * rho);
+    double f;  // cosine of the angle to the field
+    for (uint32_t attempt = 0;; attempt++) {
+      siteStream.uniforms(streamSweeps, s, 4 + 2 * attempt, u1, u2);
+      siteStream.uniforms(streamSweeps, s, 5 + 2 * attempt, u3, unused);
+      double z = std::cos(M_PI * u1);
+      f = (1 + r * z) / (r + z);
+      double c = kappa * (r - f);
+      if (c * (2 - c) > u2 || std::log(c / u2) + 1 - c >= 0) break;
+    }
+    f = std::clamp(f, -1.0, 1.0);
+    double g = std::sqrt(1 - f * f);  // sine of that angle
+    if (u3 < 0.5) g = -g;
+    double cx = hx / h, cy = hy / h;
+    moveSpin(s, cx * f - cy * g, cy * f + cx * g, hx, hy, d);
+  }
+
+  // Red/black sweep of a single-site kernel step(s, nb, delta), rows split
+  // over the pool, or a serial raster sweep when the lattice is not
+  // bipartite. Totals are summed in row order as in MetropolisCheckerboard.
+  // The cos/sin tables are rebuilt first if another kernel moved the spins.
+  template <typename Step>
+  void siteSweep(Step step) {
+    if (!tablesValid) {
+      tabulate();
+      tablesValid = true;
+    }
+    if (!bipartite()) {
+      Delta d;
+      for (int r = 0; r < rows(); r++) {
+        Row current = row(r);
+        for (int x = 0; x < L[0]; x++) step(current.base + x, neighbors(current, x), d);
+      }
+      apply(d);
+      return;
+    }
+    rowDeltas.assign(rows(), Delta{});
+    for (int color = 0; color < 2; color++) {
+      forRows([&](int begin, int end, int) {
+        for (int r = begin; r < end; r++) {
+          Row current = row(r);
+          for (int x = (current.parity + color) & 1; x < L[0]; x += 2) {
+            step(current.base + x, neighbors(current, x), rowDeltas[r]);
+          }
+        }
+      });
+    }
+    for (const auto& d : rowDeltas) apply(d);
+  }
+
+  void prepareScratch() {
+    const int m = (L[0] + 1) / 2;
+    scratch.resize(threads());
+    for (auto& w : scratch) {
+      for (auto* v : {&w.theta, &w.delta, &w.u, &w.out, &w.de, &w.dmx, &w.dmy}) v->resize(m);
+      w.neighbor.resize(2 * D * m);
+      w.site.resize(m);
+    }
+  }
+
+  // Lock-free union-find. Roots are only ever linked below smaller roots,
+  // so every cluster ends up rooted at its smallest site index, whatever
+  // order the threads unite in. find() halves paths as it goes.
+  int find(int x) const {
+    while (true) {
+      int p = parent[x].load(std::memory_order_relaxed);
+      if (p == x) return x;
+      int gp = parent[p].load(std::memory_order_relaxed);
+      if (p != gp) parent[x].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+      x = gp;
+    }
+  }
+
+  void unite(int a, int b) {
+    while (true) {
+      a = find(a);
+      b = find(b);
+      if (a == b) return;
+      if (a < b) std::swap(a, b);
+      int expected = a;
+      if (parent[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel)) return;
+    }
+  }
+
+  void prepareClusters() {
+    if (static_cast<int>(projection.size()) == volume) return;
+    projection.assign(volume, 0.0);
+    flipped.assign(volume, 0);
+    parent = std::make_unique<std::atomic<int>[]>(volume);
+  }
+
+  // Per-row partial sums of Measure(), added up in row order.
+  struct RowMeasurement {
+    double e = 0, mx = 0, my = 0, vortices = 0;
+    std::array<double, D> bondCos{}, bondSin{};
+  };
+  std::vector<RowMeasurement> rowMeasurements;
+
+  void forRows(const std::function<void(int begin, int end, int tid)>& f) {
+    if (pool) pool->parallelFor(rows(), f); else f(0, rows(), 0);
+  }
+
+  bool bipartite() const {
+    return std::all_of(L.begin(), L.end(), [](int n) { return n % 2 == 0; });
+  }
+
 public:
   std::vector<double> spins;
-  float T;
+  float T = 1.0;
+
+  // One configuration's observables from Measure(), all per site. bondCos
+  // and bondSin are the sums of cos and sin(theta_x - theta_{x+e_d}) over
+  // the bonds along each axis; see helicity(). vortices counts plaquettes
+  // with nonzero winding, summed over the D(D-1)/2 orientations (2D: vortices
+  // plus antivortices, 3D: vortex line length).
+  struct Measurement {
+    double energy = 0, mx = 0, my = 0, vortices = 0;
+    std::array<double, D> bondCos{}, bondSin{};
+
+    double magnetization() const { return std::hypot(mx, my); }
+  };
+
+  // Helicity modulus along axis d from averages over configurations of
+  // bondCos[d] and bondSin[d]^2 (volume sites, temperature T):
+  // Y = <c> - volume / T * <s^2>, as <s> vanishes by symmetry.
+  static double helicity(double meanCos, double meanSin2, int volume, double T) {
+    return meanCos - volume / T * meanSin2;
+  }
 
-  XYModel(int Nx_, int Ny_, float T_ = 1.0) : Nx(Nx_), Ny(Ny_), T(T_) {
-    spins = std::vector<double>(Nx * Ny, 0.0);
-    std::random_device seed;
-    rng = std::mt19937(seed());
+  template <std::integral... Ns>
+    requires (sizeof...(Ns) == D)
+  explicit XYLattice(Ns... n) {
+    std::random_device device;
+    seed((static_cast<uint64_t>(device()) << 32) | device());
     rand = std::uniform_real_distribution<double>(0.0, 1.0);
     randPI = std::uniform_real_distribution<double>(0.0, 2 * M_PI);
+    resize(n...);
+    setThreads(1);
   }
-    
-  void resize(int Nx_, int Ny_) {
-    Nx = Nx_;
-    Ny = Ny_;
-    spins.resize(Nx * Ny, 0.0);
+
+  template <std::integral... Ns>
+    requires (sizeof...(Ns) == D)
+  void resize(Ns... n) {
+    L = {static_cast<int>(n)...};
+    volume = 1;
+    for (int d = 0; d < D; d++) {
+      stride[d] = volume;
+      volume *= L[d];
+    }
+    spins.assign(volume, 0.0);
+    wolffT = -1;
+    prepareWorkspace();
+    if (!scratch.empty()) prepareScratch();
+    resync();
+  }
+
+  // Reseeds both generators. Runs with equal (seed, stream) are identical,
+  // independent of the thread count; distinct streams are independent.
+  void seed(uint64_t seed, uint64_t stream = 0) {
+    uint64_t key = prng::streamKey(seed, stream);
+    if constexpr (std::constructible_from<Rng, uint64_t, uint64_t>) {
+      rng = Rng(seed, stream);
+    } else {
+      rng = Rng(static_cast<typename Rng::result_type>(key));
+    }
+    siteStream = prng::SiteStream(prng::streamKey(key, 1));
+    streamSweeps = 0;
+  }
+
+  // Everything but the spins that a run depends on: the generators, the
+  // stream sweep counter, the running totals and the Wolff cluster budget
+  // (bit patterns, so a restored run continues exactly). The per-site stream
+  // key follows from the seed. Restore after seed() and after writing spins, without resync().
+  std::string state() const {
+    std::ostringstream os;
+    os << rng << ' ' << streamSweeps << ' ' << sweepsSinceResync;
+    for (double sum : {energySum, mxSum, mySum}) os << ' ' << std::bit_cast<uint64_t>(sum);
+    os << ' ' << std::bit_cast<uint64_t>(wolffSites) << ' ' << wolffCount << ' ' << std::bit_cast<uint32_t>(wolffT);
+    return os.str();
+  }
+
+  void setState(const std::string& state) {
+    std::istringstream is(state);
+    uint64_t bits[4];
+    uint32_t t;
+    tablesValid = false;
+    is >> rng >> streamSweeps >> sweepsSinceResync >> bits[0] >> bits[1] >> bits[2] >> bits[3] >> wolffCount >> t;
+    wolffSites = std::bit_cast<double>(bits[3]);
+    wolffT = std::bit_cast<float>(t);
+    energySum = std::bit_cast<double>(bits[0]);
+    mxSum = std::bit_cast<double>(bits[1]);
+    mySum = std::bit_cast<double>(bits[2]);
   }
-    
+
+  int size() const { return volume; }
+  int extent(int d) const { return L[d]; }
+  int clustersLastSweep() const { return wolffClusters; }
+
+  // Update counters since the last takeStats(); all zero when built without
+  // XY_TELEMETRY.
+  const telemetry::UpdateStats& updateStats() const { return stats; }
+  telemetry::UpdateStats takeStats() { return std::exchange(stats, {}); }
+
+  // Threads used by Metropolis(), HeatBath(), OverRelax() and
+  // SwendsenWang(). All split their passes over rows; with even extents the
+  // single-site sweeps are two checkerboard half-sweeps.
+  void setThreads(int threads) {
+    threads = std::max(threads, 1);
+    pool = threads > 1 ? std::make_unique<ThreadPool>(threads) : nullptr;
+    prepareScratch();
+  }
+
+  int threads() const { return pool ? pool->size() : 1; }
+
+  // Selects the vectorized Metropolis kernel (fastmath trig/exp, absolute
+  // error below 1e-10) over the scalar libm reference. Like the checkerboard
+  // sweep it needs even extents.
+  void setVectorized(bool on) { vectorized = on; }
+  bool isVectorized() const { return vectorized; }
+
   void initializeData(bool aligned = false) {
     if (aligned) {
       double angle = randomAngle();
@@ -42,100 +571,343 @@ public:
     } else {
       std::generate(spins.begin(), spins.end(), [this]{ return this->randomAngle(); });
     }
+    resync();
+  }
+
+  // Recomputes the running totals from spins. Call it after writing to
+  // spins directly.
+  void resync() {
+    tablesValid = false;
+    mxSum = mySum = 0;
+    for (const double& spin : spins) {
+      mxSum += std::cos(spin);
+      mySum += std::sin(spin);
+    }
+    energySum = Energy() * volume;
+    sweepsSinceResync = 0;
   }
 
-  double Magnetization() {
+  void setResyncInterval(int sweeps) { resyncInterval = std::max(sweeps, 1); }
+
+  // Swaps spin configurations (and their running totals) with a lattice of
+  // the same shape, as in a replica exchange. O(1).
+  void exchange(XYLattice& other) {
+    tablesValid = other.tablesValid = false;
+    std::swap(spins, other.spins);
+    std::swap(energySum, other.energySum);
+    std::swap(mxSum, other.mxSum);
+    std::swap(mySum, other.mySum);
+    std::swap(sweepsSinceResync, other.sweepsSinceResync);
+  }
+
+  // O(1) observables from the running totals, per site like Energy() and
+  // Magnetization().
+  double currentEnergy() const { return energySum / volume; }
+  double currentMagnetization() const { return std::hypot(mxSum, mySum) / volume; }
+  double currentMx() const { return mxSum / volume; }
+  double currentMy() const { return mySum / volume; }
+
+  double Magnetization() const {
     double sumX = 0, sumY = 0;
     for (const double& spin : spins) {
       sumX += std::cos(spin);
       sumY += std::sin(spin);
     }
-    return std::hypot(sumX, sumY) / (Nx * Ny);
+    return std::hypot(sumX, sumY) / volume;
   }
 
-  double Energy() {
+  // Every bond is counted once, through the +1 neighbour on each axis.
+  double Energy() const {
     double sum = 0;
-    for (int y = 0; y < Ny; y++) {
-      for (int x = 0; x < Nx; x++) {
-        sum -= (
-          std::cos(spins[y * Nx + x] - spins[y * Nx + (x + 1) % Nx]) +
-          std::cos(spins[y * Nx + x] - spins[((y + 1) % Ny) * Nx + x])
-        );
+    for (int r = 0; r < rows(); r++) {
+      Row current = row(r);
+      for (int x = 0; x < L[0]; x++) {
+        int s = current.base + x;
+        sum -= std::cos(spins[s] - spins[current.base + forward(0, x)]);
+        for (int d = 1; d < D; d++) {
+          sum -= std::cos(spins[s] - spins[s + current.offsets[2 * (d - 1)]]);
+        }
+      }
+    }
+    return sum / volume;
+  }
+
+  // Energy, magnetization, helicity sums and vortex density in one pass over
+  // the bonds. Each spin's cos and sin are computed once (fastmath, absolute
+  // error below 1e-10), and every bond's cos and sin of the angle difference
+  // follow from them by products; the windings only need the wrapped
+  // differences. Rows are split over the
+  // thread pool, with partial sums added in row order.
+  Measurement Measure() {
+    tabulate(true);
+    tablesValid = false;
+    rowMeasurements.assign(rows(), RowMeasurement{});
+    forRows([&](int begin, int end, int) {
+      for (int r = begin; r < end; r++) {
+        Row current = row(r);
+        RowMeasurement& m = rowMeasurements[r];
+        for (int x = 0; x < L[0]; x++) {
+          int s = current.base + x;
+          std::array<int, D> up;
+          up[0] = current.base + forward(0, x);
+          for (int d = 1; d < D; d++) up[d] = s + current.offsets[2 * (d - 1)];
+
+          m.mx += cosine[s];
+          m.my += sine[s];
+          for (int d = 0; d < D; d++) {
+            double c = cosine[s] * cosine[up[d]] + sine[s] * sine[up[d]];
+            m.e -= c;
+            m.bondCos[d] += c;
+            m.bondSin[d] += sine[s] * cosine[up[d]] - cosine[s] * sine[up[d]];
+          }
+
+          // Winding around the plaquette s, s + e_a, s + e_a + e_b, s + e_b.
+          for (int a = 0; a < D; a++) {
+            for (int b = a + 1; b < D; b++) {
+              int ab = up[a] + current.offsets[2 * (b - 1)];
+              double winding = fastmath::reduceAngle(spins[up[a]] - spins[s]) +
+                               fastmath::reduceAngle(spins[ab] - spins[up[a]]) +
+                               fastmath::reduceAngle(spins[up[b]] - spins[ab]) +
+                               fastmath::reduceAngle(spins[s] - spins[up[b]]);
+              m.vortices += std::abs(winding) > M_PI;
+            }
+          }
+        }
       }
+    });
+
+    Measurement total;
+    for (const auto& m : rowMeasurements) {
+      total.energy += m.e;
+      total.mx += m.mx;
+      total.my += m.my;
+      total.vortices += m.vortices;
+      for (int d = 0; d < D; d++) {
+        total.bondCos[d] += m.bondCos[d];
+        total.bondSin[d] += m.bondSin[d];
+      }
+    }
+    for (double* v : {&total.energy, &total.mx, &total.my, &total.vortices}) *v /= volume;
+    for (int d = 0; d < D; d++) {
+      total.bondCos[d] /= volume;
+      total.bondSin[d] /= volume;
     }
-    return sum / (Nx * Ny);
+    return total;
   }
 
+  // Checkerboard sweep when every extent is even, otherwise (the periodic
+  // lattice is not bipartite) a serial raster sweep.
   void Metropolis() {
-    double energy_now, energy_after, delta;
-
-    for (int y = 0; y < Ny; y++) {
-      for (int x = 0; x < Nx; x++) {
-        energy_now = -(
-          std::cos(spins[y * Nx + x] - spins[y * Nx + ((x + 1) % Nx)]) +
-          std::cos(spins[y * Nx + x] - spins[y * Nx + ((x - 1 + Nx) % Nx)]) +
-          std::cos(spins[y * Nx + x] - spins[((y + 1) % Ny) * Nx + x]) +
-          std::cos(spins[y * Nx + x] - spins[((y - 1 + Ny) % Ny) * Nx + x])
-        );
-
-        delta = randomAngle();
-        energy_after = -(
-          std::cos(spins[y * Nx + x] + delta - spins[y * Nx + ((x + 1) % Nx)]) +
-          std::cos(spins[y * Nx + x] + delta - spins[y * Nx + ((x - 1 + Nx) % Nx)]) +
-          std::cos(spins[y * Nx + x] + delta - spins[((y + 1) % Ny) * Nx + x]) +
-          std::cos(spins[y * Nx + x] + delta - spins[((y - 1 + Ny) % Ny) * Nx + x])
-        );
-
-        if (energy_after < energy_now || random() < std::exp(-(energy_after - energy_now) / T)) {
-          spins[y * Nx + x] = std::fmod(spins[y * Nx + x] + delta + 2 * M_PI, 2 * M_PI);
+    tablesValid = false;
+    if constexpr (telemetry::enabled) stats.attempts += volume;
+    if (bipartite()) {
+      MetropolisCheckerboard();
+      countSweep();
+      return;
+    }
+
+    Delta d;
+    for (int r = 0; r < rows(); r++) {
+      Row current = row(r);
+      for (int x = 0; x < L[0]; x++) {
+        double delta = randomAngle();
+        metropolisStep(current.base + x, neighbors(current, x), delta, random(), d);
+      }
+    }
+    apply(d);
+    countSweep();
+  }
+
+  // Microcanonical over-relaxation sweep: every spin is reflected about its
+  // local field. Not ergodic on its own; see Hybrid().
+  void OverRelax() {
+    siteSweep([this](int s, const std::array<int, 2 * D>& nb, Delta& d) { overRelaxStep(s, nb, d); });
+    countSweep();
+  }
+
+  // Heat-bath sweep: every spin is drawn afresh from its local conditional,
+  // so there are no rejected moves at any temperature.
+  void HeatBath() {
+    siteSweep([this](int s, const std::array<int, 2 * D>& nb, Delta& d) { heatBathStep(s, nb, d); });
+    streamSweeps++;
+    countSweep();
+  }
+
+  // One heat-bath sweep followed by overRelax over-relaxation sweeps.
+  void Hybrid(int overRelax = 4) {
+    HeatBath();
+    for (int i = 0; i < overRelax; i++) OverRelax();
+  }
+
+  // Swendsen-Wang with embedded Ising spins: every site is split along a
+  // random axis r, every bond is activated with 1 - exp(-2 beta proj_s
+  // proj_n) (when positive), and each resulting cluster is reflected about
+  // r with probability 1/2. Bond activation, labelling and the reflection
+  // are each split over rows on the thread pool; the random numbers come
+  // from the site stream, so the result does not depend on the thread count.
+  void SwendsenWang() {
+    tablesValid = false;
+    prepareClusters();
+    double r, unused;
+    siteStream.uniforms(streamSweeps, 0, axisTag, r, unused);
+    r *= 2 * M_PI;
+    const double beta = 1.0 / T;
+
+    forRows([&](int begin, int end, int) {
+      for (int row = begin; row < end; row++) {
+        int base = this->row(row).base;
+        for (int s = base; s < base + L[0]; s++) {
+          projection[s] = std::cos(r - spins[s]);
+          parent[s].store(s, std::memory_order_relaxed);
         }
       }
+    });
+
+    // Bonds through the +1 neighbour on each axis, so each is tried once.
+    forRows([&](int begin, int end, int) {
+      for (int row = begin; row < end; row++) {
+        Row current = this->row(row);
+        for (int x = 0; x < L[0]; x++) {
+          int s = current.base + x;
+          std::array<double, 4> u;
+          siteStream.uniforms(streamSweeps, s, 1, u[0], u[1]);
+          if constexpr (D > 2) siteStream.uniforms(streamSweeps, s, 2, u[2], u[3]);
+          for (int d = 0; d < D; d++) {
+            int n = d == 0 ? current.base + forward(0, x) : s + current.offsets[2 * (d - 1)];
+            double coupling = projection[s] * projection[n];
+            if (coupling > 0 && u[d] < 1 - std::exp(-2 * beta * coupling)) unite(s, n);
+          }
+        }
+      }
+    });
+
+    // Each root decides for its cluster; the flags are read in the next pass.
+    forRows([&](int begin, int end, int) {
+      for (int row = begin; row < end; row++) {
+        int base = this->row(row).base;
+        for (int s = base; s < base + L[0]; s++) {
+          int root = find(s);
+          double coin, unused;
+          siteStream.uniforms(streamSweeps, root, 3, coin, unused);
+          flipped[s] = coin < 0.5;
+        }
+      }
+    });
+
+    // A bond changes energy by 2 * proj_s * proj_n if exactly one end flips;
+    // each spin that flips loses twice its component along r.
+    rowDeltas.assign(rows(), Delta{});
+    forRows([&](int begin, int end, int) {
+      for (int row = begin; row < end; row++) {
+        Row current = this->row(row);
+        Delta& d = rowDeltas[row];
+        double projSum = 0;
+        for (int x = 0; x < L[0]; x++) {
+          int s = current.base + x;
+          for (int k = 0; k < D; k++) {
+            int n = k == 0 ? current.base + forward(0, x) : s + current.offsets[2 * (k - 1)];
+            if (flipped[s] != flipped[n]) d.e += 2 * projection[s] * projection[n];
+          }
+          if (flipped[s]) projSum += projection[s];
+        }
+        d.mx = -2 * projSum * std::cos(r);
+        d.my = -2 * projSum * std::sin(r);
+      }
+    });
+    forRows([&](int begin, int end, int) {
+      for (int row = begin; row < end; row++) {
+        int base = this->row(row).base;
+        for (int s = base; s < base + L[0]; s++) {
+          if (flipped[s]) spins[s] = std::fmod(2 * r - spins[s] + 3 * M_PI, 2 * M_PI);
+        }
+      }
+    });
+    for (const auto& d : rowDeltas) apply(d);
+    streamSweeps++;
+    countSweep();
+  }
+
+  // Clusters for one Wolff() sweep: enough to flip about volume spins, by
+  // the mean cluster size at this T so far. The count must not depend on
+  // the clusters of the sweep itself: stopping once they add up to volume
+  // favours sweeps that ended on a small cluster and biases everything
+  // measured after them.
+  int wolffBudget() {
+    if (T != wolffT) {
+      wolffT = T;
+      wolffSites = 0;
+      wolffCount = 0;
     }
+    if (wolffCount == 0) return 1;
+    return std::max(1, static_cast<int>(std::ceil(volume * wolffCount / wolffSites)));
   }
 
   void Wolff() {
-    int flippedSpins = 0, i = 0;
-    std::vector<int> neighbors(4, 0);
+    tablesValid = false;
+    const int clusters = wolffBudget();
+    int flippedSpins = 0;
 
-    do {
+    for (int i = 0; i < clusters; i++) {
       auto r = randomAngle();
-      
-      std::queue<int> stack;
-      std::vector<bool> visited(Nx * Ny, false);
+      unsigned stamp = nextGeneration();
       int clusterSize = 0;
+      double projSum = 0;
 
-      stack.push(static_cast<int>(random() * Nx * Ny));
+      Site seed{static_cast<int>(random() * volume), {}};
+      for (int d = 0, rest = seed.index; d < D; d++) {
+        seed.x[d] = rest % L[d];
+        rest /= L[d];
+      }
+      visited[seed.index] = stamp;
+      stack.push_back(seed);
 
       while (!stack.empty()) {
-        int s = stack.front();
-        stack.pop();
+        Site site = stack.back();
+        stack.pop_back();
+        int s = site.index;
 
+        // Projection on r before the reflection, which flips its sign.
+        double proj = std::cos(r - spins[s]);
         spins[s] = std::fmod(2 * r - spins[s] + 3 * M_PI, 2 * M_PI);
-        int x = s % Nx;
-        int y = s / Nx;
-
-        neighbors[0] = ((y - 1 + Ny) % Ny) * Nx + x;  // top
-        neighbors[1] = y * Nx + ((x + 1) % Nx);       // right
-        neighbors[2] = ((y + 1) % Ny) * Nx + x;       // bottom
-        neighbors[3] = y * Nx + ((x - 1 + Nx) % Nx);  // left
-
-        for (const auto& neighbor: neighbors) {
-          if (
-            !visited[neighbor] &&
-            (random() < 1 - std::exp(std::min(0.0, 2 / T * std::cos(r - spins[s]) * std::cos(r - spins[neighbor]))))
-          ) {
-            visited[neighbor] = true;
-            stack.push(neighbor);
+
+        for (int d = 0; d < D; d++) {
+          int c = site.x[d];
+          for (int next : {forward(d, c), backward(d, c)}) {
+            Site neighbor = site;
+            neighbor.x[d] = next;
+            neighbor.index = s + (next - c) * stride[d];
+
+            // Reflecting s changes this bond's energy by 2 * proj * proj_n.
+            // Summed in flip order this telescopes to the cluster's boundary.
+            double projNeighbor = std::cos(r - spins[neighbor.index]);
+            energySum += 2 * proj * projNeighbor;
+            if (
+              visited[neighbor.index] != stamp &&
+              (random() < 1 - std::exp(std::min(0.0, -2 / T * proj * projNeighbor)))
+            ) {
+              visited[neighbor.index] = stamp;
+              stack.push_back(neighbor);
+            }
           }
         }
+        projSum += proj;
         clusterSize++;
       }
+      // Every reflected spin loses twice its component along r.
+      mxSum -= 2 * projSum * std::cos(r);
+      mySum -= 2 * projSum * std::sin(r);
 
-      i++;
       flippedSpins += clusterSize;
-      // Attempt to flip Nx*Ny spin in total, in order 
-      // to compare to Metropolis, which flips Nx*Ny spins.
-      // If next cluster would exceed it, exit.
-    } while (flippedSpins * (1. + 1. / i) < Nx * Ny);
+      if constexpr (telemetry::enabled) stats.addCluster(clusterSize);
+    }
+    wolffSites += flippedSpins;
+    wolffCount += clusters;
+    wolffClusters = clusters;
+    if constexpr (telemetry::enabled) stats.wolffSweeps++;
+    countSweep();
   }
 };
+
+using XYModel = XYLattice<2>;
+using XYModel3D = XYLattice<3>;
+using XYModel4D = XYLattice<4>;
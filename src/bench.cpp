@@ -0,0 +1,405 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <functional>
+#include <array>
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define XY_PERF_EVENTS 1
+#endif
+#include "XYModel.hpp"
+#include "TiledLattice.hpp"
+#include "ReplicaLattice.hpp"
+#include "ClockLattice.hpp"
+
+// Microbenchmarks of the lattice kernels, for tracking performance across
+// commits. Every kernel is timed on 2D and 3D lattices at a low, a critical
+// and a high temperature, single-threaded; the threaded kernels are then
+// timed again on one larger lattice per dimension for 1, 2, 4, ... threads,
+// and Metropolis and Wolff on the largest lattices once more in the tiled and
+// Morton layouts of TiledLattice, and Metropolis on 8 interleaved replicas
+// (ReplicaLattice) at every size, per replica site, and the Z_q clock model
+// (ClockLattice, layout "Clock<q>") on the largest lattices. Where Linux perf events can be read, the
+// last-level cache and data TLB misses per site are recorded as well.
+// A human-readable table goes to stderr and the results as JSON to stdout
+// (or to --out).
+//
+//   xy_bench [--quick] [--full] [--min-time SECONDS] [--label TEXT] [--out FILE]
+//
+// --quick stops at L = 32 with short timings, --full runs 3D up to L = 256
+// (16.7M spins, slow). --label is stored as is, e.g. the commit hash.
+
+struct Options {
+  double minTime = 0.25;  // seconds per case, after warm-up
+  int maxSize2D = 256;
+  int maxSize3D = 128;
+  std::string label;
+  std::string out;
+};
+
+struct Result {
+  std::string kernel;
+  int D, L, threads;
+  std::string phase;
+  double T;
+  long repetitions = 0;  // sweeps, or evaluations for Energy and Magnetization
+  double seconds = 0;
+  double clusters = 0;   // Wolff only
+  std::string layout = "RowMajor";
+  int replicas = 1;  // lattices updated together; per site means per replica site
+  double cacheMisses = -1, tlbMisses = -1;  // over all repetitions, -1 if unavailable
+};
+
+// Nominal temperatures below, near and above the transition (BKT in 2D).
+struct Phase {
+  const char* name;
+  double T;
+};
+
+constexpr Phase phases2D[] = {{"low", 0.5}, {"critical", 0.89}, {"high", 1.5}};
+constexpr Phase phases3D[] = {{"low", 1.0}, {"critical", 2.2}, {"high", 3.5}};
+
+template <int D>
+XYLattice<D> makeLattice(int L) {
+  if constexpr (D == 2) return XYLattice<2>(L, L);
+  else return XYLattice<3>(L, L, L);
+}
+
+// Runs f until minTime has passed (at least three times) and returns the
+// count and the elapsed seconds.
+std::pair<long, double> timeRepeated(const std::function<void()>& f, double minTime) {
+  using Clock = std::chrono::steady_clock;
+  long n = 0;
+  auto start = Clock::now();
+  double elapsed = 0;
+  do {
+    f();
+    n++;
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  } while (elapsed < minTime || n < 3);
+  return {n, elapsed};
+}
+
+// Last-level cache and data TLB read misses of the calling thread between
+// start() and stop(), or -1 where perf events are missing or not permitted
+// (perf_event_paranoid, containers).
+class MissCounters {
+  std::array<int, 2> fd{-1, -1};
+
+public:
+  MissCounters() {
+#ifdef XY_PERF_EVENTS
+    const std::array<std::pair<uint32_t, uint64_t>, 2> events = {{
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    }};
+    for (int i = 0; i < 2; i++) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = events[i].first;
+      attr.config = events[i].second;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fd[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+  }
+
+  ~MissCounters() {
+#ifdef XY_PERF_EVENTS
+    for (int f : fd) if (f >= 0) close(f);
+#endif
+  }
+
+  void start() {
+#ifdef XY_PERF_EVENTS
+    for (int f : fd) {
+      if (f < 0) continue;
+      ioctl(f, PERF_EVENT_IOC_RESET, 0);
+      ioctl(f, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  std::array<double, 2> stop() {
+    std::array<double, 2> counts{-1, -1};
+#ifdef XY_PERF_EVENTS
+    for (int i = 0; i < 2; i++) {
+      uint64_t count;
+      if (fd[i] < 0) continue;
+      ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd[i], &count, sizeof(count)) == sizeof(count)) counts[i] = static_cast<double>(count);
+    }
+#endif
+    return counts;
+  }
+};
+
+// Times run after a few warm-up calls, so the timed ones start from a
+// typical configuration with warm caches, and adds the result to results.
+// clusters is reset after the warm-up and read back afterwards. Misses are
+// only counted single-threaded, as the counters follow the calling thread.
+void timeKernel(const Options& options, Result result, int sites, const std::function<void()>& run, long& clusters,
+                std::vector<Result>& results) {
+  for (int i = 0; i < 5; i++) run();
+  clusters = 0;
+  MissCounters counters;
+  counters.start();
+  auto [n, seconds] = timeRepeated(run, options.minTime);
+  auto misses = counters.stop();
+  result.repetitions = n;
+  result.seconds = seconds;
+  result.clusters = static_cast<double>(clusters);
+  if (result.threads == 1) {
+    result.cacheMisses = misses[0];
+    result.tlbMisses = misses[1];
+  }
+  results.push_back(result);
+
+  const auto& r = results.back();
+  const double perSite = static_cast<double>(n) * sites * r.replicas;
+  std::cerr << (r.D == 2 ? "2D " : "3D ") << "L=" << r.L << " " << r.phase << " T=" << r.T
+            << " threads=" << r.threads << " " << r.kernel;
+  if (r.layout != "RowMajor") std::cerr << " (" << r.layout << ")";
+  std::cerr << ": " << 1e9 * seconds / perSite << " ns/site, " << n / seconds << " /s";
+  if (r.clusters > 0) std::cerr << ", " << r.clusters / seconds << " clusters/s";
+  if (r.cacheMisses >= 0) std::cerr << ", " << r.cacheMisses / perSite << " LLC misses/site";
+  if (r.tlbMisses >= 0) std::cerr << ", " << r.tlbMisses / perSite << " dTLB misses/site";
+  std::cerr << "\n";
+}
+
+volatile double sink;
+
+template <int D>
+void benchKernels(const Options& options, int L, const Phase& phase, int threads, bool scaling,
+                  std::vector<Result>& results) {
+  auto xy = makeLattice<D>(L);
+  xy.seed(12345, L);
+  xy.T = phase.T;
+  xy.setThreads(threads);
+  xy.initializeData(phase.T < (D == 2 ? 0.89 : 2.2));
+
+  struct Kernel {
+    const char* name;
+    bool threaded;
+    std::function<void()> run;
+  };
+  long clusters = 0;
+  std::vector<Kernel> kernels = {
+    {"Metropolis", true, [&] { xy.Metropolis(); }},
+    {"MetropolisScalar", true, [&] { xy.Metropolis(); }},
+    {"Wolff", false, [&] { xy.Wolff(); clusters += xy.clustersLastSweep(); }},
+    {"SwendsenWang", true, [&] { xy.SwendsenWang(); }},
+    {"HeatBath", true, [&] { xy.HeatBath(); }},
+    {"Energy", false, [&] { sink = xy.Energy(); }},
+    {"Magnetization", false, [&] { sink = xy.Magnetization(); }},
+    {"Measure", true, [&] { sink = xy.Measure().energy; }},
+  };
+
+  for (auto& kernel : kernels) {
+    if (scaling && !kernel.threaded) continue;
+    xy.setVectorized(std::string(kernel.name) != "MetropolisScalar");
+    timeKernel(options, {kernel.name, D, L, threads, phase.name, phase.T}, xy.size(), kernel.run, clusters, results);
+  }
+}
+
+// Metropolis on ReplicaLattice<D, 8>, every replica on a stream of its own.
+template <int D>
+void benchReplicas(const Options& options, int L, const Phase& phase, std::vector<Result>& results) {
+  std::unique_ptr<ReplicaLattice<D, 8>> xy;
+  if constexpr (D == 2) xy = std::make_unique<ReplicaLattice<D, 8>>(L, L);
+  else xy = std::make_unique<ReplicaLattice<D, 8>>(L, L, L);
+  for (int k = 0; k < xy->replicas(); k++) {
+    xy->seed(k, 12345, L + k);
+    xy->T[k] = phase.T;
+  }
+  xy->initializeData();
+
+  Result result{"Metropolis", D, L, 1, phase.name, phase.T};
+  result.layout = "Interleaved";
+  result.replicas = xy->replicas();
+  long clusters = 0;
+  timeKernel(options, result, xy->size(), [&] { xy->Metropolis(); }, clusters, results);
+}
+
+// Metropolis and Wolff on one lattice in the row-major layout of XYLattice
+// and in both layouts of TiledLattice, single-threaded. All three go through
+// the same configurations, so only the memory access pattern differs. Then
+// the same on ClockLattice at q = 16 and 2^16 (a different model, with
+// 16-bit spins and table lookups).
+template <int D>
+void benchLayouts(const Options& options, int L, const Phase& phase, std::vector<Result>& results) {
+  auto run = [&](const char* layout, auto& xy) {
+    xy.seed(12345, L);
+    xy.T = phase.T;
+    xy.initializeData(phase.T < (D == 2 ? 0.89 : 2.2));
+    long clusters = 0;
+    for (const char* kernel : {"Metropolis", "MetropolisScalar", "Wolff"}) {
+      Result result{kernel, D, L, 1, phase.name, phase.T};
+      result.layout = layout;
+      if constexpr (requires { xy.setVectorized(true); }) {
+        xy.setVectorized(std::string(kernel) != "MetropolisScalar");
+      } else if (std::string(kernel) == "MetropolisScalar") {
+        continue;
+      }
+      if (std::string(kernel) == "Wolff") {
+        timeKernel(options, result, xy.size(), [&] { xy.Wolff(); clusters += xy.clustersLastSweep(); }, clusters,
+                   results);
+      } else {
+        timeKernel(options, result, xy.size(), [&] { xy.Metropolis(); }, clusters, results);
+      }
+    }
+  };
+
+  for (int q : {16, 1 << 16}) {
+    std::unique_ptr<ClockLattice<D>> xy;
+    if constexpr (D == 2) xy = std::make_unique<ClockLattice<D>>(q, L, L);
+    else xy = std::make_unique<ClockLattice<D>>(q, L, L, L);
+    run(("Clock" + std::to_string(q)).c_str(), *xy);
+  }
+
+  using Layout = typename TiledLattice<D>::Layout;
+  {
+    auto xy = makeLattice<D>(L);
+    run("RowMajor", xy);
+  }
+  for (auto [name, layout] : {std::pair{"Tiled", Layout::Tiled}, std::pair{"Morton", Layout::Morton}}) {
+    std::unique_ptr<TiledLattice<D>> xy;
+    if constexpr (D == 2) xy = std::make_unique<TiledLattice<D>>(layout, L, L);
+    else xy = std::make_unique<TiledLattice<D>>(layout, L, L, L);
+    run(name, *xy);
+  }
+}
+
+std::vector<int> threadCounts() {
+  int hardware = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> counts;
+  for (int t = 1; t < hardware; t *= 2) counts.push_back(t);
+  counts.push_back(hardware);
+  return counts;
+}
+
+std::string jsonString(const std::string& s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+std::string json(const Options& options, const std::vector<Result>& results) {
+  std::ostringstream os;
+  os.precision(6);
+  std::time_t now = std::time(nullptr);
+  char date[32];
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+  os << "{\n";
+  os << "  \"label\": " << jsonString(options.label) << ",\n";
+  os << "  \"date\": " << jsonString(date) << ",\n";
+  os << "  \"compiler\": " << jsonString(__VERSION__) << ",\n";
+  os << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+  os << "  \"min_time\": " << options.minTime << ",\n";
+  os << "  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& r = results[i];
+    double sites = std::pow(r.L, r.D) * r.replicas;
+    os << "    {\"kernel\": " << jsonString(r.kernel) << ", \"layout\": " << jsonString(r.layout) << ", \"replicas\": " << r.replicas << ", \"D\": " << r.D << ", \"L\": " << r.L
+       << ", \"threads\": " << r.threads << ", \"phase\": " << jsonString(r.phase) << ", \"T\": " << r.T
+       << ", \"repetitions\": " << r.repetitions << ", \"seconds\": " << r.seconds
+       << ", \"ns_per_site\": " << 1e9 * r.seconds / (r.repetitions * sites)
+       << ", \"per_second\": " << r.repetitions / r.seconds;
+    if (r.cacheMisses >= 0) os << ", \"cache_misses_per_site\": " << r.cacheMisses / (r.repetitions * sites);
+    if (r.tlbMisses >= 0) os << ", \"tlb_misses_per_site\": " << r.tlbMisses / (r.repetitions * sites);
+    if (r.kernel == "Wolff") {
+      os << ", \"clusters_per_second\": " << r.clusters / r.seconds
+         << ", \"sites_per_cluster\": " << r.repetitions * sites / r.clusters;
+    }
+    // Speedup over the single-threaded run of the same case.
+    if (r.threads > 1) {
+      for (const auto& base : results) {
+        if (base.threads == 1 && base.kernel == r.kernel && base.layout == r.layout && base.D == r.D &&
+            base.L == r.L && base.phase == r.phase) {
+          os << ", \"speedup\": " << (r.repetitions / r.seconds) / (base.repetitions / base.seconds);
+          break;
+        }
+      }
+    }
+    os << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  os << "  ]\n}\n";
+  return os.str();
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        std::cerr << arg << " needs a value\n";
+        std::exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--quick") {
+      options.minTime = 0.02;
+      options.maxSize2D = options.maxSize3D = 32;
+    } else if (arg == "--full") {
+      options.maxSize3D = 256;
+    } else if (arg == "--min-time") {
+      options.minTime = std::stod(value());
+    } else if (arg == "--label") {
+      options.label = value();
+    } else if (arg == "--out") {
+      options.out = value();
+    } else {
+      std::cerr << "Unknown argument " << arg << "\n";
+      return 1;
+    }
+  }
+
+  std::vector<Result> results;
+  for (int L = 8; L <= options.maxSize2D; L *= 2) {
+    for (const auto& phase : phases2D) benchKernels<2>(options, L, phase, 1, false, results);
+  }
+  for (int L = 8; L <= options.maxSize3D; L *= 2) {
+    for (const auto& phase : phases3D) benchKernels<3>(options, L, phase, 1, false, results);
+  }
+
+  // Thread scaling at the critical point, where the cluster kernels do the
+  // most work per sweep.
+  for (int threads : threadCounts()) {
+    if (threads == 1) continue;
+    benchKernels<2>(options, options.maxSize2D, phases2D[1], threads, true, results);
+    benchKernels<3>(options, std::min(options.maxSize3D, 64), phases3D[1], threads, true, results);
+  }
+
+  // Interleaved replicas against the single lattices above.
+  for (int L = 8; L <= options.maxSize2D; L *= 2) benchReplicas<2>(options, L, phases2D[1], results);
+  for (int L = 8; L <= options.maxSize3D; L *= 2) benchReplicas<3>(options, L, phases3D[1], results);
+
+  // Layouts at the critical point, on the largest lattices.
+  benchLayouts<2>(options, options.maxSize2D, phases2D[1], results);
+  benchLayouts<3>(options, options.maxSize3D, phases3D[1], results);
+
+  std::string report = json(options, results);
+  if (options.out.empty()) {
+    std::cout << report;
+  } else {
+    std::ofstream(options.out) << report;
+  }
+  return 0;
+}
@@ -1,12 +1,23 @@
 #include <iostream>
 #include <highfive/H5Easy.hpp>
 #include <vector>
-#include <queue>
-#include <random>
 #include <cmath>
 #include <algorithm>
 #include <string>
+#include <thread>
+#include <chrono>
+#include <optional>
+#include <functional>
+#include <filesystem>
 #include "XYModel.hpp"
+#include "ParallelTempering.hpp"
+#include "Autocorrelation.hpp"
+#include "AdaptiveSampler.hpp"
+#include "ResultStore.hpp"
+#include "SeriesWriter.hpp"
+#include "MeasurementPipeline.hpp"
+#include "SnapshotStore.hpp"
+#include "Telemetry.hpp"
 
 std::vector<double> linspace(double a, double b, int steps) {
   std::vector<double> result(steps, 0.0);
@@ -17,278 +28,322 @@ std::vector<double> linspace(double a, double b, int steps) {
   return result;
 }
 
-class XYModel3D {
-private:
-  std::mt19937 rng;
-  std::uniform_real_distribution<double> rand;
-  std::uniform_real_distribution<double> randPI;
-  int Nx;
-  int Ny;
-  int Nz;
-
-public:
-  std::vector<double> spins;
-  float T;
-
-  // Class constructor
-public:
-  XYModel3D(int Nx, int Ny, int Nz, float T = 1.0): Nx(Nx), Ny(Ny), Nz(Nz), T(T) {
-    spins = std::vector<double>(Nx * Ny, 0.0);
-    std::random_device seed;
-    rng = std::mt19937(seed());
-    rand = std::uniform_real_distribution(0.0, 1.0);
-    randPI = std::uniform_real_distribution(0.0, 2 * M_PI);
-  }
-
-private:
-  double random() { return rand(rng); }
-  double randomAngle() { return randPI(rng); }
-
-public:
-  void resize(int Nx, int Ny, int Nz) {
-    this->Nx = Nx;
-    this->Ny = Ny;
-    this->Nz = Nz;
-
-    spins.resize(Nx * Ny * Nz);
-    std::fill(spins.begin(), spins.end(), 0.0);
-  }
-
-  void initializeData(bool aligned = false) {
-    if (aligned) {
-      double angle = randomAngle();
-      std::fill(spins.begin(), spins.end(), angle);
-    } else {
-      std::generate(spins.begin(), spins.end(), std::bind(&XYModel3D::randomAngle, this));
-    }
-    
-  };
-
-  double Magnetization() {
-    double sumX=0, sumY=0;
-    for (const double& spin: spins) {
-      sumX += std::cos(spin);
-      sumY += std::sin(spin);
-    }
-    return std::hypot(sumX, sumY) / Nx/Ny/Nz;
-  }
-
-  double Energy() {
-    double sum = 0;
-    for (int z = 0; z < Nz; z++) {
-      for (int y = 0; y < Ny; y++) {
-        for (int x = 0; x < Nx; x++) {
-          sum -= (
-            std::cos(spins[z * Nx*Ny + y * Nx + x] - spins[z * Nx*Ny + y * Nx + ((x + 1) % Nx)]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] - spins[z * Nx*Ny + ((y + 1) % Ny) * Nx + x]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] - spins[((z + 1) % Nz) * Nx*Ny + y * Nx + x])
-            // std::cos(spins[y * Nx + x] - spins[y * Nx + (x + 1) % Nx]) +
-            // std::cos(spins[y * Nx + x] - spins[((y + 1) % Ny) * Nx + x])
-          );
-        }
-      }
-    }
-    return sum / Nx/Ny/Nz;
-  }
-
-  void Metropolis() {
-    double energy_now, energy_after, delta;
-
-    for (int z = 0; z < Nz; z++) {
-      for (int y = 0; y < Ny; y++) {
-        for (int x = 0; x < Nx; x++) {
-          energy_now = -(
-            std::cos(spins[z * Nx*Ny + y * Nx + x] - spins[z * Nx*Ny + y * Nx + ((x + 1) % Nx)]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] - spins[z * Nx*Ny + y * Nx + ((x - 1 + Nx) % Nx)]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] - spins[z * Nx*Ny + ((y + 1) % Ny) * Nx + x]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] - spins[z * Nx*Ny + ((y - 1 + Ny) % Ny) * Nx + x]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] - spins[((z + 1) % Nz) * Nx*Ny + y * Nx + x]) + 
-            std::cos(spins[z * Nx*Ny + y * Nx + x] - spins[((z - 1 + Nz) % Nz) * Nx*Ny + y * Nx + x])
-          );
-
-          delta = randomAngle();
-          energy_after = -(
-            std::cos(spins[z * Nx*Ny + y * Nx + x] + delta - spins[z * Nx*Ny + y * Nx + ((x + 1) % Nx)]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] + delta - spins[z * Nx*Ny + y * Nx + ((x - 1 + Nx) % Nx)]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] + delta - spins[z * Nx*Ny + ((y + 1) % Ny) * Nx + x]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] + delta - spins[z * Nx*Ny + ((y - 1 + Ny) % Ny) * Nx + x]) +
-            std::cos(spins[z * Nx*Ny + y * Nx + x] + delta - spins[((z + 1) % Nz) * Nx*Ny + y * Nx + x]) + 
-            std::cos(spins[z * Nx*Ny + y * Nx + x] + delta - spins[((z - 1 + Nz) % Nz) * Nx*Ny + y * Nx + x])
-          );
-
-          if (energy_after < energy_now || random() < std::exp(-(energy_after - energy_now) / T)) {
-            spins[z * Nx*Ny + y * Nx + x] = std::fmod(spins[z * Nx*Ny + y * Nx + x] + delta + 2 * M_PI, 2 * M_PI);
-          }
-        }
-      }
-    }
-  }
+void generateData(ResultStore::Mode mode, std::vector<int> gridSizes = std::vector({256, 128, 64, 32, 16, 8})) {
 
-  void Wolff() {
-    int flippedSpins = 0, i = 0, x, y, z;
-    std::vector<int> neighbors(6, 0);
-
-    do {
-      auto r = randomAngle();
-      
-      std::queue<int> stack;
-      std::vector<bool> visited(Nx*Ny*Nz, false);
-      int clusterSize = 0;
-
-      stack.push(static_cast<int>(random() * Nx*Ny*Nz));
-
-      while(!stack.empty()) {
-        int s = stack.front();
-        stack.pop();
-
-        spins[s] = std::fmod(2*r - spins[s] + 3*M_PI, 2 * M_PI);
-        x = s % Nx;
-        y = (s / Nx) % Ny;
-        z = s / (Nx*Ny);
-
-        neighbors[0] = z * Nx*Ny + y * Nx + ((x + 1) % Nx);
-        neighbors[1] = z * Nx*Ny + y * Nx + ((x - 1 + Nx) % Nx);
-        neighbors[2] = z * Nx*Ny + ((y + 1) % Ny) * Nx + x;
-        neighbors[3] = z * Nx*Ny + ((y - 1 + Ny) % Ny) * Nx + x;
-        neighbors[4] = ((z + 1) % Nz) * Nx*Ny + y * Nx + x;
-        neighbors[5] = ((z - 1 + Nz) % Nz) * Nx*Ny + y * Nx + x;
-
-        for (const auto& neighbor: neighbors) {
-          if (
-            !visited[neighbor] &&
-            (random() < 1 - std::exp(std::min(0.0, 2/T * std::cos(r - spins[s]) * std::cos(r - spins[neighbor]))))
-          ) {
-            visited[neighbor] = true;
-            stack.push(neighbor);
-          }
-        }
-        clusterSize++;
-      }
-
-      i++;
-      flippedSpins += clusterSize;
-      // Attempt to flip Nx*Ny spin in total, in order 
-      // to compare to Metropolis, which flips Nx*Ny spins.
-      // If next cluster would exceed it, exit.
-    } while (flippedSpins * (1. + 1./i) < Nx*Ny*Nz);
-  }
-};
-
-void generateData(std::vector<int> gridSizes = std::vector({256, 128, 64, 32, 16, 8})) {
-
-  H5Easy::File output("../data/data3D.hdf5", H5Easy::File::Overwrite);
+  // Update statistics and the time split between sweeps, measurements and
+  // output, written to /Telemetry at the end; see Telemetry.hpp.
+  Telemetry telemetry;
+  // Every finished point is written at once; see ResultStore.
+  ResultStore output("../data/data3D.hdf5", mode);
+  output.setTelemetry(&telemetry);
 
   const int N_BURN = 512;
   const int N_STEPS = 512;
   const int N_T = 101;        // Number of points on the temperature grid.
   const int REPETITIONS = 20; // To calculate mean and std.
+  const uint64_t SEED = 20240601;
+  // Replica exchange across the whole T grid instead of walking it point by
+  // point; burn-in is then paid once per repetition.
+  const bool TEMPERING = false;
+  // Minimum wall time between checkpoints of a temperature walk.
+  const double CHECKPOINT_SECONDS = 600;
+  // Keep the per-sweep E and M series too, under /<algo>/Series/{E,M}.
+  const bool SERIES = false;
+  // Detect burn-in and sample each point until the errors on E, M, C and X
+  // meet the targets, with a second, freshly disordered lattice to compare
+  // against. Errors and sweep counts are stored next to the results.
+  const bool ADAPTIVE = false;
+  AdaptiveSettings adaptive;
+  // Measure every sampled configuration in full on a thread of its own
+  // (MeasurementPipeline), so the next sweep starts at once, and store the
+  // helicity modulus Y and vortex density V next to E, M, C and X. At most
+  // PIPELINE_DEPTH configurations wait to be measured. Temperature walks
+  // without ADAPTIVE only.
+  const bool PIPELINED = false;
+  const int PIPELINE_DEPTH = 2;
+  // Keep every SNAPSHOT_INTERVAL-th sampled configuration (0: none) in
+  // ../data/snapshots/N<N>.xysnap, as 16-bit angles; see SnapshotStore.hpp.
+  // With WARM_START, a point starts from the configuration stored by earlier
+  // runs closest to its T, if one is within WARM_DT, and burns in for
+  // WARM_BURN sweeps only. Temperature walks without ADAPTIVE only.
+  const int SNAPSHOT_INTERVAL = 0;
+  const bool WARM_START = false;
+  const double WARM_DT = 0.02;
+  const int WARM_BURN = 64;
+  // Interval of the JSON status line (progress, acceptance, time split).
+  const double STATUS_SECONDS = 30;
 
   double _e, _m; // just placeholders, not really important
   
 
   XYModel3D xyz(1, 1, 1);
+  // Single lattice at a time, so spread each Metropolis sweep over all cores.
+  // With PIPELINED, one core is left to the measurements.
+  xyz.setThreads(std::thread::hardware_concurrency() - (PIPELINED ? 1 : 0));
+  xyz.setVectorized(true);
+  std::optional<MeasurementPipeline<XYModel3D>> pipeline;
+  std::optional<SnapshotWriter> snapshots;
+  std::optional<SnapshotReader> warm;
+  // Second chain of ADAPTIVE, built (with its threads) on the first walk.
+  std::optional<XYModel3D> hot;
   
   // Setting temperature grid points
   auto T = linspace(1.75, 3.25, N_T);
-  output.createDataSet("/T", T);
-  output.createDataSet("/gridSizes", gridSizes);
+  output.setInput("/T", T);
+  output.setInput("/gridSizes", gridSizes);
     
   // Actual data used to plot
   // Observable holds data for grid size, temperature, and repetitions (mean +/- std.)
-  std::vector E(gridSizes.size(), std::vector(N_T, std::vector(REPETITIONS, 0.0)));
-  std::vector M(gridSizes.size(), std::vector(N_T, std::vector(REPETITIONS, 0.0)));
-  std::vector C(gridSizes.size(), std::vector(N_T, std::vector(REPETITIONS, 0.0)));
-  std::vector X(gridSizes.size(), std::vector(N_T, std::vector(REPETITIONS, 0.0)));
+  const std::vector<std::string> observables = {"E", "M", "C", "X"};
+  const std::vector<std::string> pipelinedObservables = {"E", "M", "C", "X", "Y", "V"};
+  const std::vector<std::string> adaptiveObservables = {"E", "M", "C", "X", "dE", "dM", "dC", "dX", "Burn", "Sweeps"};
+  const size_t grids = gridSizes.size();
+  // Every algorithm has its own streams; see sweep() for the names.
+  const std::vector<std::string> algorithms = {"Wolff", "Metropolis", "SwendsenWang", "HeatBath", "Hybrid"};
+  const int OVERRELAX = 4;  // over-relaxation sweeps per heat-bath sweep in Hybrid
+  const uint64_t STREAMS = algorithms.size() * grids * REPETITIONS;
+
+  auto sweep = [&](int a, XYModel3D& model) {
+    Telemetry::Timer timer(telemetry, Telemetry::Update);
+    switch (a) {
+      case 0: model.Wolff(); break;
+      case 1: model.Metropolis(); break;
+      case 2: model.SwendsenWang(); break;
+      case 3: model.HeatBath(); break;
+      default: model.Hybrid(OVERRELAX);
+    }
+  };
 
+  // With SERIES all writes go through the background writer, in order, so
+  // nothing is marked done or checkpointed before the series before it.
+  std::optional<SeriesWriter> writer;
+  if (SERIES) writer.emplace(output);
+  auto deliver = [&](std::vector<SeriesWriter::Row> rows, std::function<void()> then) {
+    if (writer) writer->push(std::move(rows), std::move(then)); else then();
+  };
 
-  // Wolff Algorithm here. Takes about ~4h in 2D case.
-  for (int n = 0; n < gridSizes.size(); n++) {
+  auto prepare = [&](const std::string& algo) {
+    output.prepareTable("/" + algo, {grids, N_T, REPETITIONS}, ADAPTIVE ? adaptiveObservables : PIPELINED && !TEMPERING ? pipelinedObservables : observables);
+    if (SERIES) {
+      output.prepareSeries("/" + algo + "/Series/E", {grids, N_T, REPETITIONS, N_STEPS});
+      output.prepareSeries("/" + algo + "/Series/M", {grids, N_T, REPETITIONS, N_STEPS});
+    }
+  };
+
+  auto store = [&](const std::string& algo, int n, int i, int rep, double e, double m, double e2, double m2,
+                   std::vector<double> eSeries = {}, std::vector<double> mSeries = {}, std::vector<double> extra = {}) {
     int N = gridSizes[n];
-    xyz.resize(N, N, N);
-    
-    for (int rep = 0; rep < REPETITIONS; rep++) {
-      xyz.initializeData();
+    std::vector<size_t> index = {size_t(n), size_t(i), size_t(rep)};
+    std::vector<double> values = {
+      e,
+      m,
+      (e2 - e*e) * N*N*N / T[i]/T[i],
+      (m2 - m*m) * N*N*N / T[i],
+    };
+    values.insert(values.end(), extra.begin(), extra.end());
+    const auto* names = extra.empty() ? &observables : &pipelinedObservables;
+    std::vector<SeriesWriter::Row> rows;
+    if (SERIES) {
+      rows.push_back({"/" + algo + "/Series/E", {index[0], index[1], index[2], 0}, std::move(eSeries)});
+      rows.push_back({"/" + algo + "/Series/M", {index[0], index[1], index[2], 0}, std::move(mSeries)});
+    }
+    deliver(std::move(rows), [&, algo, index, values, names] { output.store("/" + algo, index, *names, values); });
+  };
 
-      for (int i = 0; i < N_T; i++) {
-        xyz.T = T[i];
-        double e=0, m=0, e2=0, m2=0;
-    
-        for (int i = 0; i < N_BURN; i++) xyz.Wolff();
-      
-        for (int i = 0; i < N_STEPS; i++) {
-          xyz.Wolff();
-      
-          _e = xyz.Energy();
-          _m = xyz.Magnetization();
-      
-          e += _e / N_STEPS;
-          m += _m / N_STEPS;
-          e2 += _e * _e / N_STEPS;
-          m2 += _m * _m / N_STEPS;
-        }
-        E[n][i][rep] = e;
-        M[n][i][rep] = m;
-        C[n][i][rep] = (e2 - e*e) * N*N*N / T[i]/T[i];
-        X[n][i][rep] = (m2 - m*m) * N*N*N / T[i];
-    
-        std::cout << "\rProgress: Wolff, N=" << N << " - " << (100.0 * (rep*N_T + i + 1)/(REPETITIONS*N_T)) << "%   " << std::flush;
-      }
+  auto finished = [&](const std::string& algo, int n, int rep) {
+    for (int i = 0; i < N_T; i++) {
+      if (!output.done("/" + algo, {size_t(n), size_t(i), size_t(rep)})) return false;
     }
-  }
+    return true;
+  };
 
-  output.createDataSet("/Wolff/E", E);
-  output.createDataSet("/Wolff/M", M);
-  output.createDataSet("/Wolff/C", C);
-  output.createDataSet("/Wolff/X", X);
+  // One replica per temperature, all sweeps spread over the cores.
+  auto runTempering = [&](int a, int n, int rep) {
+    int N = gridSizes[n];
+    const std::string algo = algorithms[a];
+    if (finished(algo, n, rep)) {
+      telemetry.pointDone(N_T);
+      return;
+    }
+    uint64_t stream = (a * gridSizes.size() + n) * REPETITIONS + rep;
+    ParallelTempering<XYModel3D> pt(T, std::thread::hardware_concurrency(), SEED + stream, [&](int t) {
+      XYModel3D replica(N, N, N);
+      replica.seed(SEED, stream * N_T + t);
+      replica.setVectorized(true);
+      replica.initializeData();
+      return replica;
+    });
+    auto avg = sampleTempering(pt, [&](XYModel3D& replica) {
+      sweep(a, replica);
+    }, N_BURN, N_STEPS, SERIES);
+    for (int t = 0; t < pt.size(); t++) telemetry.add(pt.replica(t).takeStats());
+
+    for (int i = 0; i < N_T; i++) {
+      if (SERIES) store(algo, n, i, rep, avg.e[i], avg.m[i], avg.e2[i], avg.m2[i], avg.eSeries[i], avg.mSeries[i]);
+      else store(algo, n, i, rep, avg.e[i], avg.m[i], avg.e2[i], avg.m2[i]);
+    }
+    telemetry.pointDone(N_T);
+  };
 
-  // For 3d Model, only consider Wolff, as it's superior
-  // For 2d Model, remove the return statement.
-  return;
+  // One point of a walk at T[i], continuing from the current xyz.
+  auto fixedPoint = [&](int a, int n, int i, int rep) {
+    double e=0, m=0, e2=0, m2=0;
+    std::vector<double> eSeries(SERIES ? N_STEPS : 0), mSeries(SERIES ? N_STEPS : 0);
+    const uint64_t stream = (a * gridSizes.size() + n) * REPETITIONS + rep;
+    auto keep = [&](int step) {
+      if (snapshots && (step + 1) % std::max(SNAPSHOT_INTERVAL, 1) == 0) snapshots->append(xyz, T[i], stream, step);
+    };
+
+    int burn = N_BURN;
+    if (warm) {
+      if (auto k = warm->nearest(T[i], WARM_DT)) {
+        warm->restore(*k, xyz);
+        burn = WARM_BURN;
+      }
+    }
+    for (int i = 0; i < burn; i++) sweep(a, xyz);
+
+    if (pipeline) {
+      for (int i = 0; i < N_STEPS; i++) {
+        sweep(a, xyz);
+        Telemetry::Timer timer(telemetry, Telemetry::Measure);
+        pipeline->push(xyz);
+        keep(i);
+      }
+      Telemetry::Timer timer(telemetry, Telemetry::Measure);
+      auto avg = pipeline->take();
+      store(algorithms[a], n, i, rep, avg.e, avg.m, avg.e2, avg.m2, std::move(avg.eSeries), std::move(avg.mSeries),
+            {avg.helicity(xyz.size(), T[i]), avg.vortices});
+      return;
+    }
+  
+    for (int i = 0; i < N_STEPS; i++) {
+      sweep(a, xyz);
+      Telemetry::Timer timer(telemetry, Telemetry::Measure);
+  
+      _e = xyz.currentEnergy();
+      _m = xyz.currentMagnetization();
+  
+      e += _e / N_STEPS;
+      m += _m / N_STEPS;
+      e2 += _e * _e / N_STEPS;
+      m2 += _m * _m / N_STEPS;
+      if (SERIES) {
+        eSeries[i] = _e;
+        mSeries[i] = _m;
+      }
+      keep(i);
+    }
+    store(algorithms[a], n, i, rep, e, m, e2, m2, std::move(eSeries), std::move(mSeries));
+  };
 
-  // Use Metropolis now. Takes about ~4h
-  E = std::vector(gridSizes.size(), std::vector(N_T, std::vector(REPETITIONS, 0.0)));
-  M = std::vector(gridSizes.size(), std::vector(N_T, std::vector(REPETITIONS, 0.0)));
-  C = std::vector(gridSizes.size(), std::vector(N_T, std::vector(REPETITIONS, 0.0)));
-  X = std::vector(gridSizes.size(), std::vector(N_T, std::vector(REPETITIONS, 0.0)));
+  auto adaptivePoint = [&](int a, int n, int i, int rep, uint64_t stream) {
+    hot->seed(SEED, STREAMS + stream * N_T + i);
+    hot->T = T[i];
+    hot->initializeData();
+    auto res = sampleAdaptive<XYModel3D>(xyz, *hot, [&](XYModel3D& chain) { sweep(a, chain); }, adaptive);
+    const std::string algo = algorithms[a];
+    std::vector<size_t> index = {size_t(n), size_t(i), size_t(rep)};
+    std::vector<double> values = {
+      res.e, res.m, res.c, res.x,
+      res.de, res.dm, res.dc, res.dx,
+      double(res.burn), double(res.burn + res.steps),
+    };
+    deliver({}, [&, algo, index, values] { output.store("/" + algo, index, adaptiveObservables, values); });
+  };
 
-  for (int n = 0; n < gridSizes.size(); n++) {
+  // Walks the T grid with one lattice, each point starting from the last
+  // configuration of the previous one. The walk is checkpointed between
+  // points; as it is seeded per (algorithm, grid, rep), points redone after
+  // a restart reproduce the values already stored.
+  auto runWalk = [&](int a, int n, int rep) {
     int N = gridSizes[n];
+    const std::string algo = algorithms[a];
+    const std::string key = algo + "/" + std::to_string(n) + "/" + std::to_string(rep);
+    if (finished(algo, n, rep)) {
+      telemetry.pointDone(N_T);
+      return;
+    }
+
+    const uint64_t stream = (a * gridSizes.size() + n) * REPETITIONS + rep;
     xyz.resize(N, N, N);
-    
-    for (int rep = 0; rep < REPETITIONS; rep++) {
+    xyz.seed(SEED, stream);
+    if (ADAPTIVE) {
+      if (!hot) {
+        hot.emplace(N, N, N);
+        hot->setThreads(std::thread::hardware_concurrency());
+        hot->setVectorized(true);
+      }
+      hot->resize(N, N, N);
+    } else if (PIPELINED) pipeline.emplace(PIPELINE_DEPTH, SERIES, N, N, N);
+    // The reader only sees what was stored before the walk began, so a point
+    // redone after a restart may start from another configuration.
+    const std::string archive = "../data/snapshots/N" + std::to_string(N) + ".xysnap";
+    warm.reset();
+    snapshots.reset();
+    if (WARM_START && !ADAPTIVE && std::filesystem::exists(archive)) warm.emplace(archive);
+    if (SNAPSHOT_INTERVAL > 0 && !ADAPTIVE) snapshots.emplace(archive, N, N, N);
+    int start = 0;
+    if (auto saved = output.loadCheckpoint(key)) {
+      xyz.spins = saved->spins;
+      xyz.setState(saved->state);
+      start = saved->step;
+      telemetry.pointDone(start);
+    } else {
       xyz.initializeData();
-      
-      for (int i = 0; i < N_T; i++) {
-        xyz.T = T[i];
-        double e=0, m=0, e2=0, m2=0;
-    
-        for (int i = 0; i < N_BURN; i++) xyz.Metropolis();
-      
-        for (int i = 0; i < N_STEPS; i++) {
-          xyz.Metropolis();
-      
-          _e = xyz.Energy();
-          _m = xyz.Magnetization();
-      
-          e += _e / N_STEPS;
-          m += _m / N_STEPS;
-          e2 += _e * _e / N_STEPS;
-          m2 += _m * _m / N_STEPS;
-        }
-        E[n][i][rep] = e;
-        M[n][i][rep] = m;
-        C[n][i][rep] = (e2 - e*e) * N*N*N / T[i]/T[i];
-        X[n][i][rep] = (m2 - m*m) * N*N*N / T[i];
-    
-        std::cout << "\rProgress: Metropolis, N=" << N << " - " << (100.0 * (rep*N_T + i + 1)/(REPETITIONS*N_T)) << "%   " << std::flush;
+    }
+
+    auto last = std::chrono::steady_clock::now();
+    for (int i = start; i < N_T; i++) {
+      xyz.T = T[i];
+
+      if (ADAPTIVE) adaptivePoint(a, n, i, rep, stream); else fixedPoint(a, n, i, rep);
+
+      auto now = std::chrono::steady_clock::now();
+      if (i + 1 < N_T && std::chrono::duration<double>(now - last).count() > CHECKPOINT_SECONDS) {
+        ResultStore::Checkpoint checkpoint{xyz.spins, xyz.state(), {}, i + 1};
+        deliver({}, [&, key, checkpoint] { output.saveCheckpoint(key, checkpoint); });
+        last = now;
       }
+      telemetry.pointDone();
     }
-  }
+    telemetry.add(xyz.takeStats());
+    if (ADAPTIVE) telemetry.add(hot->takeStats());
+    deliver({}, [&, key] { output.dropCheckpoint(key); });
+  };
+
 
-  output.createDataSet("/Metropolis/E", E);
-  output.createDataSet("/Metropolis/M", M);
-  output.createDataSet("/Metropolis/C", C);
-  output.createDataSet("/Metropolis/X", X);
+  auto run = [&](int a) {
+    prepare(algorithms[a]);
+    telemetry.addTotal(grids * REPETITIONS * N_T);
+    for (int n = 0; n < gridSizes.size(); n++) {
+      for (int rep = 0; rep < REPETITIONS; rep++) {
+        if (TEMPERING) runTempering(a, n, rep); else runWalk(a, n, rep);
+      }
+    }
+  };
+
+  // Drains pending writes, then stores the telemetry of the session.
+  auto wrapUp = [&] {
+    writer.reset();
+    telemetry.stopReporting();
+    telemetry.write(output, "/Telemetry");
+    std::cout << telemetry.statusLine() << std::endl;
+  };
+  telemetry.startReporting(STATUS_SECONDS);
+
+  // Wolff Algorithm here. Takes about ~4h in 2D case.
+  run(0);
+  wrapUp();
+
+  // For 3d Model, only consider Wolff, as it's superior
+  // For 2d Model, remove the return statement.
+  // run(2), run(3) and run(4) give Swendsen-Wang, heat bath and the hybrid.
+  return;
+
+  // Use Metropolis now. Takes about ~4h
+  run(1);
+  wrapUp();
 };
 
 void generateAutoCorrelationData(std::vector<int> gridSizes = std::vector({8, 16, 32, 64, 128})) {
@@ -297,6 +352,7 @@ void generateAutoCorrelationData(std::vector<int> gridSizes = std::vector({8, 16
   const int N_BURN = 500;
   const int N_MEAS = 5000;
   const int N_REP = 20; // Average over N_REP
+  const uint64_t SEED = 20240602;
 
   auto T = linspace(0.5, 1.5, 40);
 
@@ -304,11 +360,14 @@ void generateAutoCorrelationData(std::vector<int> gridSizes = std::vector({8, 16
   output.createDataSet("/T", T);
 
   XYModel3D xyz(1, 1, 1);
+  xyz.seed(SEED);
   
   auto run = [&](bool isWolff){
 
     std::vector M(N_MEAS, 0.0);
     std::vector C(gridSizes.size(), std::vector(T.size(), std::vector(N_REP, std::vector(N_MEAS, 0.0))));
+    std::vector Tau(gridSizes.size(), std::vector(T.size(), std::vector(N_REP, 0.0)));
+    std::vector TauError(gridSizes.size(), std::vector(T.size(), std::vector(N_REP, 0.0)));
   
     for (int i = 0; i < gridSizes.size(); i++) {
       int N = gridSizes[i];
@@ -322,43 +381,31 @@ void generateAutoCorrelationData(std::vector<int> gridSizes = std::vector({8, 16
           // configuration needs to be in equilibrium
           for (int k = 0; k < N_BURN; k++) xyz.Wolff(); // Wolff for faster burn in
     
-          double mean_m = 0.0;
           for (int k = 0; k < N_MEAS; k++) {
             isWolff ? xyz.Wolff() : xyz.Metropolis();
-            M[k] = xyz.Magnetization();
-            mean_m += M[k] / N_MEAS;
+            M[k] = xyz.currentMagnetization();
           }
     
-          // auto correlation function
-          double CX0 = 1;
-          auto Gamma = [&](int t) {
-            double t_abs = std::abs(t);
-            double CXT = 0;
-            for (int k = 0; k <= M.size() - t_abs - 1; k++) {
-              CXT += (M[k] - mean_m) * (M[k + t_abs] - mean_m);
-            }
-            CXT /= M.size() - t_abs;
-            return CXT / CX0;
-          };
-          CX0 = Gamma(0);
-          
-          // auto correlation time
-          for(int k = 0; k < M.size()-1; k++) {
-            double gamma = Gamma(k);
-            if(gamma < std::exp(-3)) break;
-            
-            C[i][j][h][k] = gamma;
+          // auto correlation function, cut off where it drops below e^-3
+          auto rho = autocorr::autocorrelation(M);
+          for (int k = 0; k < M.size()-1; k++) {
+            if (rho[k] < std::exp(-3)) break;
+            C[i][j][h][k] = rho[k];
           }
+
+          // integrated auto correlation time, Sokal window
+          auto tau = autocorr::integratedTime(rho, M.size());
+          Tau[i][j][h] = tau.tau;
+          TauError[i][j][h] = tau.error;
         }
         
         std::cout << "\r Progress N=" << N << ": " << (100.0 * (i * T.size() + j + 1)/(gridSizes.size()*T.size())) << "%" << std::flush;
       }
     }
-    if(isWolff) {
-      output.createDataSet("/Wolff/C", C);
-    } else {
-      output.createDataSet("/Metropolis/C", C);
-    }
+    const std::string group = isWolff ? "/Wolff" : "/Metropolis";
+    output.createDataSet(group + "/C", C);
+    output.createDataSet(group + "/Tau", Tau);
+    output.createDataSet(group + "/TauError", TauError);
   };
   std::cout << " ==== Wolff Algorithm ==== \n" << std::endl;
   run(true);
@@ -367,9 +414,11 @@ void generateAutoCorrelationData(std::vector<int> gridSizes = std::vector({8, 16
   std::cout << "Autocorrelation complete!" << std::endl;
 }
 
-int main() {
+// --resume continues an interrupted run, --overwrite starts over.
+int main(int argc, char** argv) {
+  auto mode = storeMode(argc, argv);
   // generateAutoCorrelationData();
-  // generateData();
-  generateData(std::vector({6,7,8,9,10,11,12}));
+  // generateData(mode);
+  generateData(mode, std::vector({6,7,8,9,10,11,12}));
   return 0;
 }
\ No newline at end of file
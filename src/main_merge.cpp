@@ -0,0 +1,66 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <exception>
+#include "ResultStore.hpp"
+#include "SweepConfig.hpp"
+
+// Combines the shard files of a sweep into the config's output, in the
+// layout of the other drivers (/T, /gridSizes, /<algorithm>/{E,M,C,X}, and
+// /clockLevels for the clock model):
+//   xy_merge sweep.cfg [--resume | --overwrite]
+// Missing shards are skipped, so it can be rerun with --resume as more of
+// them finish.
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " CONFIG [--resume | --overwrite]" << std::endl;
+    return 1;
+  }
+  try {
+    auto config = loadSweepConfig(argv[1]);
+    if (config.shards == 1) {
+      std::cout << "Single shard, " << config.output << " is complete as it is." << std::endl;
+      return 0;
+    }
+
+    const std::vector<std::string> observables = {"E", "M", "C", "X"};
+    const auto T = config.T();
+    const std::vector<size_t> dims = {config.gridSizes.size(), size_t(config.repetitions), size_t(config.temperatures)};
+
+    ResultStore output(config.output, storeMode(argc, argv));
+    output.setInput("/T", T);
+    output.setInput("/gridSizes", config.gridSizes);
+    if (config.clockLevels > 0) output.setInput("/clockLevels", config.clockLevels);
+    for (const auto& algo : config.algorithms) output.prepareTable("/" + algo, dims, observables);
+
+    size_t merged = 0;
+    for (int shard = 0; shard < config.shards; shard++) {
+      const std::string path = config.shardPath(shard);
+      if (!std::filesystem::exists(path)) {
+        std::cout << "missing " << path << std::endl;
+        continue;
+      }
+      ResultStore input(path, ResultStore::Mode::Resume);
+      // An XY shard has no /clockLevels.
+      if (input.read<std::vector<double>>("/T") != T || input.read<std::vector<int>>("/gridSizes") != config.gridSizes ||
+          input.tryRead<int>("/clockLevels").value_or(0) != config.clockLevels) {
+        throw std::runtime_error(path + " was run with a different setup");
+      }
+      for (const auto& algo : config.algorithms) merged += output.merge(input, "/" + algo, observables);
+    }
+
+    size_t done = 0;
+    for (const auto& algo : config.algorithms) {
+      for (size_t g = 0; g < dims[0]; g++)
+        for (size_t r = 0; r < dims[1]; r++)
+          for (size_t t = 0; t < dims[2]; t++) done += output.done("/" + algo, {g, r, t});
+    }
+    std::cout << merged << " points merged, " << done << " of " << config.points() << " done" << std::endl;
+  } catch (const std::exception& error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
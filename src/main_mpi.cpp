@@ -0,0 +1,114 @@
+#include <mpi.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <optional>
+#include <exception>
+#include "SlabLattice.hpp"
+#include "ResultStore.hpp"
+
+// Distributed runs of single large lattices for finite-size scaling, one
+// lattice spread over all ranks:
+//   mpirun -np 4 ./xy_mpi [--resume | --overwrite]
+// The last extent of every lattice must be a multiple of the number of ranks.
+
+std::vector<double> linspace(double a, double b, int steps) {
+  std::vector<double> result(steps, 0.0);
+  double step = (b - a) / (steps - 1);
+  for (int i = 0; i < steps; i++) {
+    result[i] = a + i * step;
+  }
+  return result;
+}
+
+// Walks the T grid for every grid size, like the serial driver; only rank 0
+// touches the file, and tells the others which points are already done.
+template <int D>
+void generateData(std::optional<ResultStore>& output, const std::string& group, std::vector<int> gridSizes,
+                  std::vector<double> T) {
+  const int N_BURN = 512;
+  const int N_STEPS = 512;
+  const uint64_t SEED = 20240603;
+  const std::vector<std::string> observables = {"E", "M", "C", "X"};
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  const size_t grids = gridSizes.size();
+  if (output) output->prepareTable(group, {grids, T.size()}, observables);
+
+  for (size_t n = 0; n < grids; n++) {
+    const int N = gridSizes[n];
+    std::optional<SlabLattice<D>> xy;
+    if constexpr (D == 2) xy.emplace(MPI_COMM_WORLD, N, N);
+    else xy.emplace(MPI_COMM_WORLD, N, N, N);
+
+    for (size_t i = 0; i < T.size(); i++) {
+      char done = output ? output->done(group, {n, i}) : 0;
+      MPI_Bcast(&done, 1, MPI_CHAR, 0, MPI_COMM_WORLD);
+      if (done) continue;
+
+      xy->seed(SEED, n * T.size() + i);
+      xy->T = T[i];
+      xy->initializeData(true);
+      for (int k = 0; k < N_BURN; k++) xy->Metropolis();
+
+      double e = 0, m = 0, e2 = 0, m2 = 0;
+      for (int k = 0; k < N_STEPS; k++) {
+        xy->Metropolis();
+        auto [_e, _m] = xy->current();
+        e += _e / N_STEPS;
+        m += _m / N_STEPS;
+        e2 += _e * _e / N_STEPS;
+        m2 += _m * _m / N_STEPS;
+      }
+
+      if (output) {
+        const double volume = xy->size();
+        output->store(group, {n, i}, observables, {
+          e,
+          m,
+          (e2 - e*e) * volume / (T[i]*T[i]),
+          (m2 - m*m) * volume / T[i],
+        });
+        std::cout << "\rProgress: " << group << ", N=" << N << " - "
+                  << (100.0 * (n * T.size() + i + 1) / (grids * T.size())) << "%   " << std::flush;
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  MPI_Init(&argc, &argv);
+  int rank, ranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  // Opened on rank 0 only; a refusal there (existing file without --resume
+  // or --overwrite) stops every rank.
+  std::optional<ResultStore> output;
+  if (rank == 0) {
+    std::cout << "MPI ranks: " << ranks << std::endl;
+    try {
+      output.emplace("../data/data_mpi.hdf5", storeMode(argc, argv));
+    } catch (const std::exception& error) {
+      std::cerr << error.what() << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+
+  // Around T_KT, for the size dependence of the helicity jump and C peak.
+  std::vector<int> gridSizes = {1024, 512, 256};
+  auto T = linspace(0.8, 1.1, 31);
+  if (output) {
+    output->setInput("/T", T);
+    output->setInput("/gridSizes", gridSizes);
+  }
+  generateData<2>(output, "/Metropolis", gridSizes, T);
+
+  // For 3D, e.g. 512^3 around T_c:
+  // generateData<3>(output, "/Metropolis3D", {512, 256}, linspace(2.1, 2.3, 21));
+
+  if (rank == 0) std::cout << "\nAll simulations completed!" << std::endl;
+  MPI_Finalize();
+  return 0;
+}
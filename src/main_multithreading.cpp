@@ -1,8 +1,20 @@
 #include "XYModel.hpp"
-#include <highfive/H5Easy.hpp>
-#include <future>
-#include <mutex>
+#include "ParallelTempering.hpp"
+#include "ReplicaLattice.hpp"
+#include "TaskScheduler.hpp"
+#include "ResultStore.hpp"
+#include "SeriesWriter.hpp"
+#include "AdaptiveSampler.hpp"
+#include "Reweighting.hpp"
+#include "SnapshotStore.hpp"
+#include "Telemetry.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <limits>
+#include <optional>
 #include <string>
 #include <thread> 
 
@@ -17,123 +29,456 @@ std::vector<double> linspace(double a, double b, int steps) {
 }
 
 
-int main() {
+int main(int argc, char** argv) {
     std::cout << "CPU-Cores: " << std::thread::hardware_concurrency() << std::endl;
 
-    H5Easy::File output("../data/data.hdf5", H5Easy::File::Overwrite);
+    // Update statistics and the time split between sweeps, measurements and
+    // output, written to /Telemetry at the end; see Telemetry.hpp.
+    Telemetry telemetry;
+    // Results are written as each point finishes. Without --resume or
+    // --overwrite an existing file is left untouched.
+    ResultStore output("../data/data.hdf5", storeMode(argc, argv));
+    output.setTelemetry(&telemetry);
 
     const int N_BURN = 512;
     const int N_STEPS = 512;
     const int N_T = 100;
     const int REPETITIONS = 20;
-    // const int THREADS_PER_GRID = 8;  // ← 8 Kerne pro Gitter!
+    const uint64_t SEED = 20240601;  // every (algorithm, grid, rep, T) gets its own stream
+    // Replica exchange: every rep runs all N_T temperatures at once and swaps
+    // neighbouring configurations after each sweep, so burn-in is paid once
+    // per rep instead of once per temperature.
+    const bool TEMPERING = false;
+    // Minimum wall time between checkpoints of a running point.
+    const double CHECKPOINT_SECONDS = 600;
+    // Also keep the per-sweep E and M of every sampling sweep, compressed,
+    // under /<algorithm>/Series/{E,M}[grid][rep][temp][step].
+    const bool SERIES = false;
+    // Detect burn-in and sample until the errors on E, M, C and X meet the
+    // targets instead of running N_BURN + N_STEPS sweeps (per-point runs
+    // only, without SERIES). Errors and sweep counts go next to the results.
+    const bool ADAPTIVE = false;
+    AdaptiveSettings adaptive;
+    // Simulate a few temperatures per rep and fill the N_T grid by
+    // multi-histogram reweighting, with jackknife errors (dE, ...), the peaks
+    // of C and X as {T, dT, height, dHeight} in CPeak and XPeak and the
+    // simulated temperatures in TSimulated (NaN-padded). REWEIGHT_COARSE runs
+    // span the whole grid. Each of up to REWEIGHT_PASSES passes then spreads
+    // REWEIGHT_REFINE runs evenly around the largest C and X measured so far,
+    // within one spacing of the previous pass, until the spacing is below
+    // REWEIGHT_SPACING energy-histogram widths (T sqrt(C / volume)) at the C
+    // peak: 18, 22 and 27 runs on 16^2, 64^2 and 128^2, a fifth of the sweeps
+    // of the N_T-point grid or less. Away from the peaks the coarse
+    // histograms only overlap on small lattices, and the values in between
+    // interpolate: Gap holds MultiHistogram::gap, the distance of the runs
+    // around each grid point in histogram widths, and points with Gap above
+    // about 2 are unreliable. One lattice climbs the coarse runs with N_BURN
+    // sweeps each; a pass starts from the stored run below it, with RUN_BURN
+    // per step.
+    const bool REWEIGHT = false;
+    const int REWEIGHT_COARSE = 12;
+    const int REWEIGHT_REFINE = 6;
+    const int REWEIGHT_PASSES = 4;
+    const double REWEIGHT_SPACING = 1.5;
+    const int RUN_BURN = 64;
+    // Also measure the helicity modulus Y (mean over both axes) and the vortex
+    // density V after every sampling sweep, in one fused pass over the
+    // lattice (fixed per-point runs only).
+    const bool KT = false;
+    // Metropolis only: run REPLICAS repetitions of a point at once in one
+    // interleaved lattice (ReplicaLattice.hpp), one vector lane each, for
+    // several times the throughput on small lattices. Every repetition keeps
+    // its stream, so the results are those of separate runs. Fixed per-point
+    // runs without SERIES or KT only, and without checkpoints.
+    const bool INTERLEAVED = false;
+    const int REPLICAS = 8;
+    // Interval of the JSON status line (progress, acceptance, time split).
+    const double STATUS_SECONDS = 30;
 
     std::vector<double> T = linspace(0.02, 2, N_T);
     std::vector<int> gridSizes = {256, 128, 64, 32, 16, 8};
-    
-    output.createDataSet("/T", T);
-    output.createDataSet("/gridSizes", gridSizes);
+    // Any of "Wolff", "SwendsenWang", "Metropolis", "HeatBath" and "Hybrid"
+    // (one heat-bath sweep plus OVERRELAX over-relaxation sweeps)
+    const std::vector<std::string> algorithms = {"Wolff", "Metropolis"};
+    const int OVERRELAX = 4;
+    const std::vector<std::string> observables = {"E", "M", "C", "X"};
+    const std::vector<std::string> adaptiveObservables = {"E", "M", "C", "X", "dE", "dM", "dC", "dX", "Burn", "Sweeps"};
+    const std::vector<std::string> ktObservables = {"E", "M", "C", "X", "Y", "V"};
+    const std::vector<std::string> reweightObservables = {"E", "M", "C", "X", "dE", "dM", "dC", "dX", "Gap"};
 
-    std::mutex dataMutex;
+    output.setInput("/T", T);
+    output.setInput("/gridSizes", gridSizes);
 
-    // Data: [grid][rep][temp]
-    std::vector E(gridSizes.size(), std::vector(REPETITIONS, std::vector(N_T, 0.0)));
-    std::vector M(gridSizes.size(), std::vector(REPETITIONS, std::vector(N_T, 0.0)));
-    std::vector C(gridSizes.size(), std::vector(REPETITIONS, std::vector(N_T, 0.0)));
-    std::vector X(gridSizes.size(), std::vector(REPETITIONS, std::vector(N_T, 0.0)));
+    // Data: /<algorithm>/{E,M,C,X}[grid][rep][temp], plus the swap acceptance
+    // between T[t] and T[t+1] with TEMPERING.
+    const size_t grids = gridSizes.size();
+    for (const auto& algo : algorithms) {
+        output.prepareTable("/" + algo, {grids, REPETITIONS, N_T},
+                            REWEIGHT ? reweightObservables : ADAPTIVE ? adaptiveObservables : KT ? ktObservables : observables);
+        if (REWEIGHT) {
+            output.prepareDataset("/" + algo + "/CPeak", {grids, REPETITIONS, 4});
+            output.prepareDataset("/" + algo + "/XPeak", {grids, REPETITIONS, 4});
+            output.prepareDataset("/" + algo + "/TSimulated", {grids, REPETITIONS, size_t(REWEIGHT_COARSE + REWEIGHT_PASSES * REWEIGHT_REFINE)});
+        }
+        if (TEMPERING) output.prepareDataset("/" + algo + "/SwapAcceptance", {grids, REPETITIONS, N_T - 1});
+        if (SERIES) {
+            output.prepareSeries("/" + algo + "/Series/E", {grids, REPETITIONS, N_T, N_STEPS});
+            output.prepareSeries("/" + algo + "/Series/M", {grids, REPETITIONS, N_T, N_STEPS});
+        }
+    }
+
+    // Series are written in the background; a point is only marked done once
+    // its series is on disk.
+    std::optional<SeriesWriter> writer;
+    if (SERIES) writer.emplace(output);
+
+    // Every lattice runs single-threaded; the scheduler keeps all cores busy
+    // with (algorithm, grid, rep, T) tasks, largest lattices first.
+    TaskScheduler scheduler;
+    const uint64_t STREAMS = algorithms.size() * grids * REPETITIONS * N_T;
+    int total = 0;
+
+    auto sweep = [&](int a, XYModel& xy) {
+        Telemetry::Timer timer(telemetry, Telemetry::Update);
+        if (algorithms[a] == "Wolff") xy.Wolff();
+        else if (algorithms[a] == "SwendsenWang") xy.SwendsenWang();
+        else if (algorithms[a] == "HeatBath") xy.HeatBath();
+        else if (algorithms[a] == "Hybrid") xy.Hybrid(OVERRELAX);
+        else xy.Metropolis();
+    };
+
+    // Folds the update counters of a finished task's lattice into the telemetry.
+    auto collect = [&](XYModel& xy) {
+        telemetry.add(xy.takeStats());
+    };
+
+    auto runGrid = [&](int a, int grid_idx, int N) {
+        const std::string group = "/" + algorithms[a];
+        const size_t g = grid_idx;
+
+        if (INTERLEAVED && algorithms[a] == "Metropolis" && !REWEIGHT && !TEMPERING && !ADAPTIVE && !SERIES && !KT) {
+            for (int t = 0; t < N_T; t++) {
+                for (int first = 0; first < REPETITIONS; first += REPLICAS) {
+                    const size_t ti = t;
+                    std::vector<size_t> reps;
+                    for (int rep = first; rep < std::min(first + REPLICAS, REPETITIONS); rep++) {
+                        if (!output.done(group, {g, size_t(rep), ti})) reps.push_back(rep);
+                    }
+                    if (reps.empty()) continue;
+                    // Lanes past the last repetition run a copy of the first.
+                    std::vector<uint64_t> streams(REPLICAS);
+                    for (int k = 0; k < REPLICAS; k++) {
+                        const size_t rep = reps[k < int(reps.size()) ? k : 0];
+                        streams[k] = ((a * gridSizes.size() + grid_idx) * REPETITIONS + rep) * N_T + t;
+                    }
+                    total += reps.size();
+                    scheduler.submit(1.0 * N * N * REPLICAS, [&, group, g, ti, N, reps, streams] {
+                        const int t = ti;
+                        ReplicaLattice<2, REPLICAS> xy(N, N);
+                        for (int k = 0; k < REPLICAS; k++) {
+                            xy.seed(k, SEED, streams[k]);
+                            xy.T[k] = T[t];
+                        }
+                        xy.initializeData(true);
+
+                        std::array<double, REPLICAS> e{}, m{}, e2{}, m2{};
+                        for (int i = 0; i < N_BURN + N_STEPS; i++) {
+                            {
+                                Telemetry::Timer timer(telemetry, Telemetry::Update);
+                                xy.Metropolis();
+                            }
+                            if (i < N_BURN) continue;
+                            Telemetry::Timer timer(telemetry, Telemetry::Measure);
+                            for (int k = 0; k < REPLICAS; k++) {
+                                double _e = xy.currentEnergy(k);
+                                double _m = xy.currentMagnetization(k);
+                                e[k] += _e / N_STEPS;
+                                m[k] += _m / N_STEPS;
+                                e2[k] += _e * _e / N_STEPS;
+                                m2[k] += _m * _m / N_STEPS;
+                            }
+                        }
 
-    auto runGrid = [&](const std::string& algoName, int grid_idx, int N) {
-        std::cout << "\n=== " << algoName << " N=" << N << " (" << grid_idx+1 << "/" << gridSizes.size() <<") ===" << std::endl;
-        
-        std::vector<std::future<void>> futures;
+                        for (size_t k = 0; k < reps.size(); k++) {
+                            output.store(group, {g, reps[k], ti}, observables, {
+                                e[k],
+                                m[k],
+                                (e2[k] - e[k]*e[k]) * N*N / (T[t]*T[t]),
+                                (m2[k] - m[k]*m[k]) * N*N / T[t],
+                            });
+                        }
+                        telemetry.add(xy.takeStats());
+                        telemetry.pointDone(reps.size());
+                    });
+                }
+            }
+            return;
+        }
 
-        // 20 Reps parallel auf 8 Threads verteilen
         for (int rep = 0; rep < REPETITIONS; rep++) {
-            futures.push_back(std::async(std::launch::async, [&](int rep) {
-                XYModel xy(N, N);
-                std::function<void()> algo;
-                if (algoName == "Wolff")
-                    algo = [&xy]() { xy.Wolff(); };
-                else
-                    algo = [&xy]() { xy.Metropolis(); };
-                
-
-                for (int t = 0; t < N_T; t++) {
-                    xy.T = T[t];
+            const uint64_t stream = ((a * gridSizes.size() + grid_idx) * REPETITIONS + rep) * N_T;
+            const size_t r = rep;
+
+            if (REWEIGHT) {
+                if (output.done(group, {g, r, 0})) continue;
+                total++;
+                scheduler.submit(1.0 * N * N * (REWEIGHT_COARSE + REWEIGHT_PASSES * REWEIGHT_REFINE), [&, a, group, g, r, N, stream] {
+                    const int V = N * N;
+                    MultiHistogram histogram(V);
+                    XYModel xy(N, N);
+                    xy.seed(SEED, stream);
+                    xy.setVectorized(true);
                     xy.initializeData(true);
-                    
-                    // Burn-in
-                    for (int i = 0; i < N_BURN; i++) {
-                        algo();
-                    }
-                    
-                    // Sampling
-                    double e = 0, m = 0, e2 = 0, m2 = 0;
-                    for (int i = 0; i < N_STEPS; i++) {
-                        algo();
-                        double _e = xy.Energy();
-                        double _m = xy.Magnetization();
-                        e += _e / N_STEPS;
-                        m += _m / N_STEPS;
-                        e2 += _e * _e / N_STEPS;
-                        m2 += _m * _m / N_STEPS;
+
+                    // Samples at t after burn sweeps, keeping the run's C and X
+                    // and its last configuration, quantized as in SnapshotStore,
+                    // to start later passes from.
+                    std::vector<double> TSim, C, X;
+                    std::vector<std::vector<uint16_t>> configurations;
+                    auto simulate = [&](double t, int burn) {
+                        xy.T = t;
+                        for (int i = 0; i < burn; i++) sweep(a, xy);
+                        std::vector<double> e(N_STEPS), m(N_STEPS);
+                        double se = 0, se2 = 0, sm = 0, sm2 = 0;
+                        for (int i = 0; i < N_STEPS; i++) {
+                            sweep(a, xy);
+                            e[i] = xy.currentEnergy();
+                            m[i] = xy.currentMagnetization();
+                            se += e[i] / N_STEPS;
+                            se2 += e[i] * e[i] / N_STEPS;
+                            sm += m[i] / N_STEPS;
+                            sm2 += m[i] * m[i] / N_STEPS;
+                        }
+                        histogram.addRun(t, std::move(e), std::move(m));
+                        TSim.push_back(t);
+                        C.push_back((se2 - se * se) * V / (t * t));
+                        X.push_back((sm2 - sm * sm) * V / t);
+                        configurations.emplace_back(xy.spins.size());
+                        for (size_t i = 0; i < xy.spins.size(); i++) configurations.back()[i] = snapshot::quantize(xy.spins[i]);
+                    };
+
+                    // The run at T.front() still relaxes from the ordered start,
+                    // which the 1 / T^2 in C blows up; it is left out of the
+                    // search for the peaks.
+                    for (double t : linspace(T.front(), T.back(), REWEIGHT_COARSE)) simulate(t, N_BURN);
+                    double step = (T.back() - T.front()) / (REWEIGHT_COARSE - 1);
+                    for (int pass = 0;; pass++) {
+                        const size_t peakC = std::max_element(C.begin() + 1, C.end()) - C.begin();
+                        const size_t peakX = std::max_element(X.begin() + 1, X.end()) - X.begin();
+                        const double lo = std::max(std::min(TSim[peakC], TSim[peakX]) - step, T.front());
+                        const double hi = std::min(std::max(TSim[peakC], TSim[peakX]) + step, T.back());
+                        if (pass == REWEIGHT_PASSES || step <= REWEIGHT_SPACING * TSim[peakC] / std::sqrt(C[peakC] * V)) break;
+                        step = (hi - lo) / (REWEIGHT_REFINE + 1);
+                        size_t start = 0;
+                        for (size_t j = 0; j < TSim.size(); j++) {
+                            if (TSim[j] <= lo + step && (TSim[start] > lo + step || TSim[j] > TSim[start])) start = j;
+                        }
+                        for (size_t i = 0; i < xy.spins.size(); i++) xy.spins[i] = snapshot::angle(configurations[start][i]);
+                        xy.resync();
+                        for (int i = 1; i <= REWEIGHT_REFINE; i++) {
+                            const double t = lo + i * step;
+                            if (std::none_of(TSim.begin(), TSim.end(), [&](double u) { return std::abs(u - t) < step / 2; })) simulate(t, RUN_BURN);
+                        }
                     }
-                    
-                    // Thread-safe store
+                    collect(xy);
+
+                    // The peaks are searched where the runs around the largest X
+                    // leave no Gap above 2.
+                    const size_t peakX = std::max_element(X.begin() + 1, X.end()) - X.begin();
+                    double lo = TSim[peakX], hi = lo;
+                    while (lo - step / 4 > TSim[1] && histogram.gap(lo - step / 4) < 2) lo -= step / 4;
+                    while (hi + step / 4 < T.back() && histogram.gap(hi + step / 4) < 2) hi += step / 4;
+                    std::sort(TSim.begin(), TSim.end());
+                    TSim.resize(REWEIGHT_COARSE + REWEIGHT_PASSES * REWEIGHT_REFINE, std::numeric_limits<double>::quiet_NaN());
+
+                    MultiHistogram::Curve curve;
+                    MultiHistogram::Peak cPeak, xPeak;
                     {
-                        std::lock_guard<std::mutex> lock(dataMutex);
-                        E[grid_idx][rep][t] = e;
-                        M[grid_idx][rep][t] = m;
-                        C[grid_idx][rep][t] = (e2 - e*e) * N*N / (T[t]*T[t]);
-                        X[grid_idx][rep][t] = (m2 - m*m) * N*N / T[t];
+                        Telemetry::Timer timer(telemetry, Telemetry::Measure);
+                        curve = histogram.reweight(T);
+                        cPeak = histogram.peak(2, lo, hi);
+                        xPeak = histogram.peak(3, lo, hi);
                     }
-                    
-                    std::cout << "\r" << algoName << " N=" << N << " rep=" << rep+1 
-                              << "/" << REPETITIONS << " T=" << t+1 << "/" << N_T 
-                              << "                                  " << std::flush;
-                }
-            }, rep));
-        }
-        
-        // Warte auf alle Reps dieses Gitters
-        for (auto& f : futures) f.get();
-        std::cout << "\nN=" << N << " completed!" << std::endl;
-    };
+                    std::vector row(reweightObservables.size(), std::vector(N_T, 0.0));
+                    for (int i = 0; i < N_T; i++) {
+                        for (int k = 0; k < 4; k++) {
+                            row[k][i] = curve.value[i][k];
+                            row[4 + k][i] = curve.error[i][k];
+                        }
+                        row[8][i] = histogram.gap(T[i]);
+                    }
+                    output.writeRow(group + "/TSimulated", {g, r, 0}, TSim);
+                    output.writeRow(group + "/CPeak", {g, r, 0}, {cPeak.T, cPeak.dT, cPeak.height, cPeak.dHeight});
+                    output.writeRow(group + "/XPeak", {g, r, 0}, {xPeak.T, xPeak.dT, xPeak.height, xPeak.dHeight});
+                    output.storeRow(group, {g, r, 0}, reweightObservables, row);
+                    telemetry.pointDone();
+                });
+                continue;
+            }
 
-    // Nacheinander: Größtes Gitter zuerst!
-    std::cout << "=== WOLFF ===" << std::endl;
-    for (int n = 0; n < gridSizes.size(); n++) {
-        runGrid("Wolff", n, gridSizes[n]);
-    }
+            if (TEMPERING) {
+                if (output.done(group, {g, r, 0})) continue;
+                total++;
+                scheduler.submit(1.0 * N * N * N_T, [&, a, group, g, r, N, stream] {
+                    ParallelTempering<XYModel> pt(T, 1, SEED + stream, [&](int t) {
+                        XYModel xy(N, N);
+                        xy.seed(SEED, stream + t);
+                        xy.setVectorized(true);
+                        xy.initializeData(true);
+                        return xy;
+                    });
+                    auto avg = sampleTempering(pt, [&](XYModel& xy) { sweep(a, xy); }, N_BURN, N_STEPS, SERIES);
+                    for (int t = 0; t < pt.size(); t++) collect(pt.replica(t));
 
-    // Speichern
-    {
-        std::lock_guard<std::mutex> lock(dataMutex);
-        output.createDataSet("/Wolff/E", E);
-        output.createDataSet("/Wolff/M", M);
-        output.createDataSet("/Wolff/C", C);
-        output.createDataSet("/Wolff/X", X);
-    }
+                    std::vector row(observables.size(), std::vector(N_T, 0.0));
+                    for (int t = 0; t < N_T; t++) {
+                        row[0][t] = avg.e[t];
+                        row[1][t] = avg.m[t];
+                        row[2][t] = (avg.e2[t] - avg.e[t]*avg.e[t]) * N*N / (T[t]*T[t]);
+                        row[3][t] = (avg.m2[t] - avg.m[t]*avg.m[t]) * N*N / T[t];
+                    }
+                    auto finish = [&, group, g, r, row] { output.storeRow(group, {g, r, 0}, observables, row); };
+                    output.writeRow(group + "/SwapAcceptance", {g, r, 0}, avg.swapRates);
+                    if (SERIES) {
+                        std::vector<SeriesWriter::Row> rows;
+                        for (size_t t = 0; t < N_T; t++) {
+                            rows.push_back({group + "/Series/E", {g, r, t, 0}, std::move(avg.eSeries[t])});
+                            rows.push_back({group + "/Series/M", {g, r, t, 0}, std::move(avg.mSeries[t])});
+                        }
+                        writer->push(std::move(rows), finish);
+                    } else {
+                        finish();
+                    }
+                    telemetry.pointDone();
+                });
+                continue;
+            }
 
-    E = std::vector(gridSizes.size(), std::vector(REPETITIONS, std::vector<double>(N_T, 0.0)));
-    M = std::vector(gridSizes.size(), std::vector(REPETITIONS, std::vector<double>(N_T, 0.0)));
-    C = std::vector(gridSizes.size(), std::vector(REPETITIONS, std::vector<double>(N_T, 0.0)));
-    X = std::vector(gridSizes.size(), std::vector(REPETITIONS, std::vector<double>(N_T, 0.0)));
-    
-    std::cout << "\n=== METROPOLIS ===" << std::endl;
-    for (int n = 0; n < gridSizes.size(); n++) {
-        runGrid("Metropolis", n, gridSizes[n]);
-    }
+            for (int t = 0; t < N_T; t++) {
+                const size_t ti = t;
+                if (output.done(group, {g, r, ti})) continue;
+                total++;
+                scheduler.submit(1.0 * N * N, [&, a, group, g, r, ti, N, stream] {
+                    const int t = ti;
+                    const std::string key = algorithms[a] + "/" + std::to_string(g) + "/" + std::to_string(r) + "/" + std::to_string(t);
+
+                    XYModel xy(N, N);
+                    xy.seed(SEED, stream + t);
+                    xy.setVectorized(true);
+                    xy.T = T[t];
+
+                    if (ADAPTIVE) {
+                        // Second chain from a disordered start, on a stream of its own
+                        XYModel hot(N, N);
+                        hot.seed(SEED, STREAMS + stream + t);
+                        hot.setVectorized(true);
+                        hot.T = T[t];
+                        xy.initializeData(true);
+                        hot.initializeData();
+                        auto res = sampleAdaptive<XYModel>(xy, hot, [&](XYModel& chain) { sweep(a, chain); }, adaptive);
+                        output.store(group, {g, r, ti}, adaptiveObservables, {
+                            res.e, res.m, res.c, res.x,
+                            res.de, res.dm, res.dc, res.dx,
+                            double(res.burn), double(res.burn + res.steps),
+                        });
+                        collect(xy);
+                        collect(hot);
+                        telemetry.pointDone();
+                        return;
+                    }
 
-    // Speichern
-    {
-        std::lock_guard<std::mutex> lock(dataMutex);
-        output.createDataSet("/Metropolis/E", E);
-        output.createDataSet("/Metropolis/M", M);
-        output.createDataSet("/Metropolis/C", C);
-        output.createDataSet("/Metropolis/X", X);
+                    // sums = {e, m, e2, m2} over the sampling sweeps done so far,
+                    // followed by the E and M series with SERIES and by the
+                    // means of bondCos, bondSin^2 and vortices with KT
+                    const int K = SERIES ? 4 + 2 * N_STEPS : 4;
+                    ResultStore::Checkpoint state{{}, {}, std::vector(KT ? K + 3 : K, 0.0), 0};
+                    if (auto saved = output.loadCheckpoint(key)) {
+                        state = std::move(*saved);
+                        xy.spins = state.spins;
+                        xy.setState(state.state);
+                    } else {
+                        xy.initializeData(true);
+                    }
+
+                    // Burn-in, then sampling
+                    auto last = std::chrono::steady_clock::now();
+                    for (int i = state.step; i < N_BURN + N_STEPS; i++) {
+                        sweep(a, xy);
+                        if (i >= N_BURN) {
+                            Telemetry::Timer timer(telemetry, Telemetry::Measure);
+                            double _e = xy.currentEnergy();
+                            double _m = xy.currentMagnetization();
+                            state.sums[0] += _e / N_STEPS;
+                            state.sums[1] += _m / N_STEPS;
+                            state.sums[2] += _e * _e / N_STEPS;
+                            state.sums[3] += _m * _m / N_STEPS;
+                            if (SERIES) {
+                                state.sums[4 + i - N_BURN] = _e;
+                                state.sums[4 + N_STEPS + i - N_BURN] = _m;
+                            }
+                            if (KT) {
+                                auto obs = xy.Measure();
+                                state.sums[K] += (obs.bondCos[0] + obs.bondCos[1]) / 2 / N_STEPS;
+                                state.sums[K + 1] += (obs.bondSin[0] * obs.bondSin[0] + obs.bondSin[1] * obs.bondSin[1]) / 2 / N_STEPS;
+                                state.sums[K + 2] += obs.vortices / N_STEPS;
+                            }
+                        }
+
+                        auto now = std::chrono::steady_clock::now();
+                        if (std::chrono::duration<double>(now - last).count() > CHECKPOINT_SECONDS) {
+                            state.spins = xy.spins;
+                            state.state = xy.state();
+                            state.step = i + 1;
+                            output.saveCheckpoint(key, state);
+                            last = now;
+                        }
+                    }
+
+                    double e = state.sums[0], m = state.sums[1], e2 = state.sums[2], m2 = state.sums[3];
+                    std::vector<double> values = {
+                        e,
+                        m,
+                        (e2 - e*e) * N*N / (T[t]*T[t]),
+                        (m2 - m*m) * N*N / T[t],
+                    };
+                    if (KT) {
+                        values.push_back(XYModel::helicity(state.sums[K], state.sums[K + 1], N*N, T[t]));
+                        values.push_back(state.sums[K + 2]);
+                    }
+                    auto finish = [&, group, key, g, r, ti, values] {
+                        output.store(group, {g, r, ti}, KT ? ktObservables : observables, values);
+                        output.dropCheckpoint(key);
+                    };
+                    if (SERIES) {
+                        auto series = state.sums.begin() + 4;
+                        writer->push({
+                            {group + "/Series/E", {g, r, ti, 0}, std::vector(series, series + N_STEPS)},
+                            {group + "/Series/M", {g, r, ti, 0}, std::vector(series + N_STEPS, series + 2 * N_STEPS)},
+                        }, finish);
+                    } else {
+                        finish();
+                    }
+                    collect(xy);
+                    telemetry.pointDone();
+                });
+            }
+        }
+    };
+
+    for (int a = 0; a < algorithms.size(); a++) {
+        for (int n = 0; n < gridSizes.size(); n++) {
+            runGrid(a, n, gridSizes[n]);
+        }
     }
+    std::cout << "=== " << total << " tasks on " << scheduler.size() << " threads ===" << std::endl;
+    telemetry.addTotal(total);
+    telemetry.startReporting(STATUS_SECONDS);
+    scheduler.run();
+    writer.reset();
+    telemetry.stopReporting();
+    telemetry.write(output, "/Telemetry");
 
-    std::cout << "\nAll simulations completed!" << std::endl;
+    std::cout << telemetry.statusLine() << std::endl;
+    std::cout << "All simulations completed!" << std::endl;
     return 0;
 }
@@ -0,0 +1,189 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <thread>
+#include <exception>
+#include <optional>
+#include "XYModel.hpp"
+#include "ClockLattice.hpp"
+#include "TaskScheduler.hpp"
+#include "ResultStore.hpp"
+#include "SweepConfig.hpp"
+#include "Telemetry.hpp"
+
+// Config-driven sweep over (algorithm, grid, rep, T), one shard of it per
+// process, so that a batch system can run the shards side by side:
+//   xy_sweep sweep.cfg --shard 3 [--threads 8] [--resume | --overwrite]
+// Without --shard the index comes from SLURM_ARRAY_TASK_ID, else 0. Every
+// point runs from an ordered start on a stream of its own, so results do not
+// depend on how the work is sharded. xy_merge combines the shard files.
+// With clockLevels set, the spins are restricted to that many angles
+// (ClockLattice.hpp), to check convergence to the XY model in q.
+
+template <int D>
+XYLattice<D> makeLattice(int N) {
+  if constexpr (D == 2) return XYLattice<2>(N, N);
+  else return XYLattice<3>(N, N, N);
+}
+
+template <int D>
+ClockLattice<D> makeClockLattice(int q, int N) {
+  if constexpr (D == 2) return ClockLattice<2>(q, N, N);
+  else return ClockLattice<3>(q, N, N, N);
+}
+
+template <int D>
+void runShard(const SweepConfig& config, int shard, int threads, ResultStore::Mode mode) {
+  const std::vector<std::string> observables = {"E", "M", "C", "X"};
+  const auto T = config.T();
+  const size_t grids = config.gridSizes.size();
+  const size_t reps = config.repetitions;
+  const size_t temps = config.temperatures;
+
+  Telemetry telemetry;
+  ResultStore output(config.shardPath(shard), mode);
+  output.setTelemetry(&telemetry);
+  output.setInput("/T", T);
+  output.setInput("/gridSizes", config.gridSizes);
+  // A resumed shard must hold the same model; XY shards have no /clockLevels.
+  if (output.tryRead<int>("/clockLevels").value_or(0) != config.clockLevels) {
+    throw std::runtime_error(config.shardPath(shard) + " was run with a different clockLevels");
+  }
+  if (config.clockLevels > 0) output.setInput("/clockLevels", config.clockLevels);
+
+  // ClockLattice only has Metropolis and Wolff; the config checks that.
+  auto sweep = [&]<typename Lattice>(const std::string& algo, Lattice& xy) {
+    Telemetry::Timer timer(telemetry, Telemetry::Update);
+    if (algo == "Wolff") xy.Wolff();
+    else if (algo == "Metropolis") xy.Metropolis();
+    else if constexpr (std::is_same_v<Lattice, XYLattice<D>>) {
+      if (algo == "SwendsenWang") xy.SwendsenWang();
+      else if (algo == "HeatBath") xy.HeatBath();
+      else xy.Hybrid(config.overRelax);
+    }
+  };
+
+  // One point from an ordered start: burn-in, then the means over the
+  // sampling sweeps.
+  auto simulate = [&](const std::string& algo, auto&& xy, uint64_t stream, double temperature) -> std::vector<double> {
+    xy.seed(config.seed, stream);
+    if constexpr (requires { xy.setVectorized(true); }) xy.setVectorized(true);
+    xy.T = temperature;
+    xy.initializeData(true);
+    for (int i = 0; i < config.burn; i++) sweep(algo, xy);
+
+    double e = 0, m = 0, e2 = 0, m2 = 0;
+    for (int i = 0; i < config.steps; i++) {
+      sweep(algo, xy);
+      double _e = xy.currentEnergy();
+      double _m = xy.currentMagnetization();
+      e += _e / config.steps;
+      m += _m / config.steps;
+      e2 += _e * _e / config.steps;
+      m2 += _m * _m / config.steps;
+    }
+    telemetry.add(xy.takeStats());
+    const double volume = xy.size();
+    return {e, m, (e2 - e*e) * volume / (temperature*temperature), (m2 - m*m) * volume / temperature};
+  };
+
+  // Data: /<algorithm>/{E,M,C,X}[grid][rep][temp], as the other drivers.
+  TaskScheduler scheduler(threads);
+  int total = 0;
+  size_t u = 0;
+  for (const auto& algo : config.algorithms) {
+    const std::string group = "/" + algo;
+    output.prepareTable(group, {grids, reps, temps}, observables);
+    for (size_t g = 0; g < grids; g++) {
+      for (size_t r = 0; r < reps; r++) {
+        for (size_t t = 0; t < temps; t++, u++) {
+          if (u % config.shards != static_cast<size_t>(shard) || output.done(group, {g, r, t})) continue;
+          const int N = config.gridSizes[g];
+          total++;
+          scheduler.submit(std::pow(N, D), [&, algo, group, g, r, t, N, stream = u] {
+            auto values = config.clockLevels > 0
+              ? simulate(algo, makeClockLattice<D>(config.clockLevels, N), stream, T[t])
+              : simulate(algo, makeLattice<D>(N), stream, T[t]);
+            output.store(group, {g, r, t}, observables, values);
+            telemetry.pointDone();
+          });
+        }
+      }
+    }
+  }
+
+  std::cout << "=== shard " << shard << " of " << config.shards << ": " << total << " points on "
+            << scheduler.size() << " threads ===" << std::endl;
+  telemetry.addTotal(total);
+  telemetry.startReporting(30);
+  scheduler.run();
+  telemetry.stopReporting();
+  telemetry.write(output, "/Telemetry");
+  std::cout << telemetry.statusLine() << std::endl;
+}
+
+int main(int argc, char** argv) {
+  auto usage = [&] {
+    std::cerr << "usage: " << argv[0] << " CONFIG [--shard I] [--threads K] [--resume | --overwrite]" << std::endl;
+    return 1;
+  };
+  if (argc < 2) return usage();
+  // A typo or a flag without its value would otherwise quietly run the
+  // default shard, duplicating another job's points.
+  auto count = [](const std::string& value) -> std::optional<int> {
+    size_t used = 0;
+    int number = -1;
+    try {
+      number = std::stoi(value, &used);
+    } catch (const std::exception&) {}
+    if (used != value.size() || number < 0) return std::nullopt;
+    return number;
+  };
+  int shard = 0;
+  if (const char* array = std::getenv("SLURM_ARRAY_TASK_ID")) {
+    auto number = count(array);
+    if (!number) {
+      std::cerr << "bad SLURM_ARRAY_TASK_ID: " << array << std::endl;
+      return 1;
+    }
+    shard = *number;
+  }
+  int threads = std::thread::hardware_concurrency();
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--resume" || arg == "--overwrite") continue;
+    if (arg != "--shard" && arg != "--threads") {
+      std::cerr << "unknown argument " << arg << std::endl;
+      return usage();
+    }
+    if (i + 1 == argc) {
+      std::cerr << "missing value for " << arg << std::endl;
+      return usage();
+    }
+    std::string value = argv[++i];
+    auto number = count(value);
+    if (!number) {
+      std::cerr << "bad value for " << arg << ": " << value << std::endl;
+      return usage();
+    }
+    (arg == "--shard" ? shard : threads) = *number;
+  }
+
+  try {
+    auto config = loadSweepConfig(argv[1]);
+    if (shard < 0 || shard >= config.shards) {
+      std::cerr << "shard " << shard << " out of range for " << config.shards << " shards" << std::endl;
+      return 1;
+    }
+
+    auto mode = storeMode(argc, argv);
+    if (config.dimension == 2) runShard<2>(config, shard, threads, mode);
+    else runShard<3>(config, shard, threads, mode);
+  } catch (const std::exception& error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}